@@ -0,0 +1,65 @@
+// Buffer cache benchmark: several processes read the same
+// files over and over, as a pipeline of cat and grep would.
+// With the file blocks cached, the time should scale with
+// the number of CPUs rather than serialize on one lock.
+//
+// usage: bcachebench [nproc]
+
+#include "types.h"
+#include "stat.h"
+#include "fcntl.h"
+#include "user.h"
+
+#define ROUNDS 20
+
+char *files[] = { "README", "cat", "grep", "ls", "sh" };
+char buf[512];
+
+// Read every file once, counting lines the way grep would look at them.
+int
+readall(void)
+{
+  int i, fd, n, j, lines;
+
+  lines = 0;
+  for(i = 0; i < sizeof(files)/sizeof(files[0]); i++){
+    if((fd = open(files[i], O_RDONLY)) < 0){
+      printf(1, "bcachebench: cannot open %s\n", files[i]);
+      exit();
+    }
+    while((n = read(fd, buf, sizeof(buf))) > 0)
+      for(j = 0; j < n; j++)
+        if(buf[j] == '\n')
+          lines++;
+    close(fd);
+  }
+  return lines;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int i, r, nproc, start;
+
+  nproc = 4;
+  if(argc > 1)
+    nproc = atoi(argv[1]);
+  if(nproc < 1){
+    printf(2, "usage: bcachebench [nproc]\n");
+    exit();
+  }
+
+  readall();  // warm the cache
+  start = uptime();
+  for(i = 0; i < nproc; i++){
+    if(fork() == 0){
+      for(r = 0; r < ROUNDS; r++)
+        readall();
+      exit();
+    }
+  }
+  for(i = 0; i < nproc; i++)
+    wait();
+  printf(1, "%d processes x %d rounds: %d ticks\n", nproc, ROUNDS, uptime() - start);
+  exit();
+}
@@ -1,6 +1,6 @@
 // Buffer cache.
 //
-// The buffer cache is a linked list of buf structures holding
+// The buffer cache is a hash table of buf structures holding
 // cached copies of disk block contents.  Caching disk blocks
 // in memory reduces the number of disk reads and also provides
 // a synchronization point for disk blocks used by multiple processes.
@@ -17,42 +17,386 @@
 // * B_VALID: the buffer data has been read from the disk.
 // * B_DIRTY: the buffer data has been modified
 //     and needs to be written to disk.
+//
+// Buffers are hashed by (dev, blockno) into NBUCKET buckets,
+// each with its own lock, so lookups and releases of different
+// blocks on different CPUs do not contend.  Replacement is
+// serialized by bcache.lock, which only misses take.  Lock
+// order is bcache.lock, then at most one bucket lock at a time.
+//
+// Replacement follows the 2Q algorithm, so that one long
+// sequential read cannot push out the inode, bitmap and
+// directory blocks everything else keeps using:
+// * A block read for the first time goes on the "in" queue,
+//   which is FIFO and limited to a quarter of the cache.
+// * A block evicted from the in queue is remembered, without
+//   its data, in a ghost list of recently evicted blocks.
+// * A block read again while in the ghost list was evicted
+//   too early; it goes on the "main" queue, which is replaced
+//   by the clock algorithm using the used bit set on each hit.
+// A streamed file passes through the in queue only.
+//
+// The cache starts with NBUF static buffers and grows, a page
+// of buffers at a time from kalloc(), up to a limit set at boot
+// from the size of physical memory.  Only then are cached
+// blocks evicted.  If every buffer is in use, bget() waits for
+// brelse() to free one.
 
 #include "types.h"
 #include "defs.h"
 #include "param.h"
 #include "spinlock.h"
 #include "sleeplock.h"
+#include "memlayout.h"
+#include "mmu.h"
 #include "fs.h"
 #include "buf.h"
+#include "bstat.h"
 
-struct {
+extern char end[]; // first address after kernel loaded from ELF file
+
+struct bucket {
   struct spinlock lock;
+  struct buf *head;   // chain through buf.hnext
+  uint hits;
+};
+
+// A block evicted from the in queue.
+struct ghost {
+  uint dev;
+  uint blockno;
+  int valid;             // 0 once the block is read again
+  struct ghost *hnext;
+};
+
+struct {
+  struct spinlock lock;  // serializes replacement
   struct buf buf[NBUF];
+  uchar data[NBUF][BSIZE];
+  struct buf *free;      // buffers that have never held a block
+  struct buf *hdr;       // unused part of the last page of headers
+  uint nhdr;
+
+  // Replacement queues, through prev/next.
+  // head.next is the newest.
+  struct buf in;
+  struct buf main;
+  uint nin;
+  uint nmain;
+
+  // Ghost list: ghost[] is a ring, oldest first, of nghost
+  // entries ending just before ghost[gnext].
+  struct ghost ghost[NGHOST];
+  struct ghost *ghash[NBUCKET];
+  uint nghost;
+  uint gnext;
 
-  // Linked list of all buffers, through prev/next.
-  // head.next is most recently used.
-  struct buf head;
+  uint nbuf;
+  uint maxbuf;
+  int nwait;             // processes waiting in bget()
+  uint misses;
+  uint evictions;
+  uint waits;
+
+  struct bucket bucket[NBUCKET];
 } bcache;
 
+static int
+bhash(uint dev, uint blockno)
+{
+  return (dev*31 + blockno) % NBUCKET;
+}
+
+static struct bucket*
+hash(uint dev, uint blockno)
+{
+  return &bcache.bucket[bhash(dev, blockno)];
+}
+
+// Add the new buffer b, with data at data, to the free list.
+static void
+addbuf(struct buf *b, uchar *data)
+{
+  memset(b, 0, sizeof(*b));
+  initsleeplock(&b->lock, "buffer");
+  b->data = data;
+  b->hnext = bcache.free;
+  bcache.free = b;
+  bcache.nbuf++;
+}
+
 void
 binit(void)
 {
-  struct buf *b;
+  struct bucket *h;
+  int i;
 
   initlock(&bcache.lock, "bcache");
+  bcache.in.prev = bcache.in.next = &bcache.in;
+  bcache.main.prev = bcache.main.next = &bcache.main;
+  for(h = bcache.bucket; h < bcache.bucket+NBUCKET; h++)
+    initlock(&h->lock, "bcache.bucket");
+  for(i = 0; i < NBUF; i++)
+    addbuf(&bcache.buf[i], bcache.data[i]);
 
-//PAGEBREAK!
-  // Create linked list of buffers
-  bcache.head.prev = &bcache.head;
-  bcache.head.next = &bcache.head;
-  for(b = bcache.buf; b < bcache.buf+NBUF; b++){
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    initsleeplock(&b->lock, "buffer");
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+  // Let the cache grow to a sixteenth of physical memory.
+  bcache.maxbuf = (PHYSTOP - V2P(end)) / 16 / (sizeof(struct buf) + BSIZE);
+  if(bcache.maxbuf < NBUF)
+    bcache.maxbuf = NBUF;
+}
+
+// Allocate another page of buffer data, and headers for it
+// from a page of headers, if the cache may grow.
+// Caller holds bcache.lock.
+static void
+grow(void)
+{
+  char *mem;
+  int i;
+
+  if(bcache.nbuf + PGSIZE/BSIZE > bcache.maxbuf)
+    return;
+  if(bcache.nhdr < PGSIZE/BSIZE){
+    if((mem = kalloc()) == 0)
+      return;
+    bcache.hdr = (struct buf*)mem;
+    bcache.nhdr = PGSIZE/sizeof(struct buf);
+  }
+  if((mem = kalloc()) == 0)
+    return;
+  for(i = 0; i < PGSIZE/BSIZE; i++){
+    addbuf(bcache.hdr++, (uchar*)mem + i*BSIZE);
+    bcache.nhdr--;
+  }
+}
+
+// Return the buffer for block blockno on dev from bucket h, or 0.
+// Caller holds h->lock.
+static struct buf*
+find(struct bucket *h, uint dev, uint blockno)
+{
+  struct buf *b;
+
+  for(b = h->head; b; b = b->hnext)
+    if(b->dev == dev && b->blockno == blockno)
+      return b;
+  return 0;
+}
+
+// Like find(), but also take a reference to the buffer.
+static struct buf*
+lookup(struct bucket *h, uint dev, uint blockno)
+{
+  struct buf *b;
+
+  if((b = find(h, dev, blockno)) != 0){
+    b->refcnt++;
+    b->used = 1;
+  }
+  return b;
+}
+
+static void
+unlink(struct buf *b)
+{
+  b->next->prev = b->prev;
+  b->prev->next = b->next;
+}
+
+// Insert b as the newest buffer of queue q.
+static void
+enqueue(struct buf *q, struct buf *b)
+{
+  b->next = q->next;
+  b->prev = q;
+  q->next->prev = b;
+  q->next = b;
+}
+
+// Forget the oldest ghost.
+static void
+dropghost(void)
+{
+  struct ghost *g, **pp;
+
+  g = &bcache.ghost[(bcache.gnext + NGHOST - bcache.nghost) % NGHOST];
+  if(g->valid){
+    pp = &bcache.ghash[bhash(g->dev, g->blockno)];
+    for(; *pp != g; pp = &(*pp)->hnext)
+      ;
+    *pp = g->hnext;
+    g->valid = 0;
+  }
+  bcache.nghost--;
+}
+
+// Remember that block blockno of dev was evicted from the in queue.
+// The ghost list holds at most half as many blocks as the cache.
+static void
+addghost(uint dev, uint blockno)
+{
+  struct ghost *g, **pp;
+  uint max;
+
+  max = bcache.nbuf/2 < NGHOST ? bcache.nbuf/2 : NGHOST;
+  while(bcache.nghost > 0 && bcache.nghost >= max)
+    dropghost();
+  if(max == 0)
+    return;
+  g = &bcache.ghost[bcache.gnext];
+  bcache.gnext = (bcache.gnext + 1) % NGHOST;
+  bcache.nghost++;
+  g->dev = dev;
+  g->blockno = blockno;
+  g->valid = 1;
+  pp = &bcache.ghash[bhash(dev, blockno)];
+  g->hnext = *pp;
+  *pp = g;
+}
+
+// If block blockno of dev is in the ghost list, take it out
+// and return 1.
+static int
+isghost(uint dev, uint blockno)
+{
+  struct ghost *g, **pp;
+
+  for(pp = &bcache.ghash[bhash(dev, blockno)]; (g = *pp) != 0; pp = &g->hnext){
+    if(g->dev == dev && g->blockno == blockno){
+      *pp = g->hnext;
+      g->valid = 0;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// Take b out of its bucket if nobody is using it.
+// log.c holds a reference (bpin) to each buffer it has
+// modified but not yet installed, so those stay put too.
+// If chance is set, a recently used b is not taken either,
+// but has its used bit cleared.  Returns 1 if b was taken.
+static int
+unhash(struct buf *b, int chance)
+{
+  struct buf **pp;
+  struct bucket *h;
+
+  h = hash(b->dev, b->blockno);
+  acquire(&h->lock);
+  if(b->refcnt != 0 || (chance && b->used)){
+    if(chance)
+      b->used = 0;
+    release(&h->lock);
+    return 0;
+  }
+  for(pp = &h->head; *pp != b; pp = &(*pp)->hnext)
+    ;
+  *pp = b->hnext;
+  release(&h->lock);
+  return 1;
+}
+
+// Evict the oldest unused buffer of the in queue, or return 0.
+static struct buf*
+evictin(void)
+{
+  struct buf *b;
+
+  for(b = bcache.in.prev; b != &bcache.in; b = b->prev){
+    if(unhash(b, 0)){
+      unlink(b);
+      bcache.nin--;
+      addghost(b->dev, b->blockno);
+      return b;
+    }
+  }
+  return 0;
+}
+
+// Evict a buffer from the main queue using the clock
+// algorithm, or return 0.  Two sweeps: the first may
+// only clear used bits.
+static struct buf*
+evictmain(void)
+{
+  struct buf *b;
+  int i;
+
+  for(i = 0; i < 2*bcache.nmain; i++){
+    b = bcache.main.prev;
+    unlink(b);
+    if(unhash(b, 1)){
+      bcache.nmain--;
+      return b;
+    }
+    enqueue(&bcache.main, b);
+  }
+  return 0;
+}
+
+// Find a buffer to reuse, out of its bucket and off the queues.
+// Caller holds bcache.lock.
+static struct buf*
+evict(void)
+{
+  struct buf *b;
+
+  if(bcache.free == 0)
+    grow();
+  if((b = bcache.free) != 0){
+    bcache.free = b->hnext;
+    return b;
+  }
+
+  // Keep the in queue to its share of the cache, but take
+  // from either queue rather than wait.
+  b = 0;
+  if(bcache.nin > bcache.nbuf/4)
+    b = evictin();
+  if(b == 0)
+    b = evictmain();
+  if(b == 0)
+    b = evictin();
+  if(b)
+    bcache.evictions++;
+  return b;
+}
+
+// Make the buffer b, just taken by evict(), hold block blockno
+// of dev, with one reference.  Caller holds bcache.lock.
+static void
+insert(struct buf *b, uint dev, uint blockno)
+{
+  struct bucket *h;
+
+  bcache.misses++;
+  b->dev = dev;
+  b->blockno = blockno;
+  b->flags = 0;
+  b->refcnt = 1;
+  b->used = 1;
+  if(isghost(dev, blockno)){
+    enqueue(&bcache.main, b);
+    bcache.nmain++;
+  } else {
+    enqueue(&bcache.in, b);
+    bcache.nin++;
   }
+  h = hash(dev, blockno);
+  acquire(&h->lock);
+  b->hnext = h->head;
+  h->head = b;
+  release(&h->lock);
+}
+
+// Unlock b and drop a reference to it.
+// It stays in its bucket until evict() recycles it.
+static void
+bput(struct buf *b)
+{
+  releasesleep(&b->lock);
+  bunpin(b);
 }
 
 // Look through buffer cache for block on device dev.
@@ -62,34 +406,92 @@ static struct buf*
 bget(uint dev, uint blockno)
 {
   struct buf *b;
+  struct bucket *h;
 
-  acquire(&bcache.lock);
+  h = hash(dev, blockno);
+  acquire(&h->lock);
+  if((b = lookup(h, dev, blockno)) != 0)
+    h->hits++;
+  release(&h->lock);
+  if(b){
+    acquiresleep(&b->lock);
+    return b;
+  }
 
-  // Is the block already cached?
-  for(b = bcache.head.next; b != &bcache.head; b = b->next){
-    if(b->dev == dev && b->blockno == blockno){
-      b->refcnt++;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
+  // Not cached; recycle an unused buffer.  Look again after
+  // getting bcache.lock, since another process may have
+  // brought the block in meanwhile.
+  acquire(&bcache.lock);
+  for(;;){
+    acquire(&h->lock);
+    if((b = lookup(h, dev, blockno)) != 0)
+      h->hits++;
+    release(&h->lock);
+    if(b || (b = evict()) != 0)
+      break;
+    // Every buffer is in use.  Announce that we are waiting
+    // before looking once more, so that a brelse() racing with
+    // the search above is sure to see nwait and wake us.
+    bcache.nwait++;
+    if((b = evict()) != 0){
+      bcache.nwait--;
+      break;
     }
+    bcache.waits++;
+    sleep(&bcache, &bcache.lock);
+    bcache.nwait--;
   }
+  if(b->refcnt == 0)
+    insert(b, dev, blockno);
+  release(&bcache.lock);
+  acquiresleep(&b->lock);
+  return b;
+}
 
-  // Not cached; recycle an unused buffer.
-  // Even if refcnt==0, B_DIRTY indicates a buffer is in use
-  // because log.c has modified it but not yet committed it.
-  for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
-    if(b->refcnt == 0 && (b->flags & B_DIRTY) == 0) {
-      b->dev = dev;
-      b->blockno = blockno;
-      b->flags = 0;
-      b->refcnt = 1;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
-    }
+// Start reading block blockno of dev into the cache, unless it
+// is there already.  Does not wait for the disk, nor for a
+// buffer: if none is free the block is not read ahead.
+void
+bprefetch(uint dev, uint blockno)
+{
+  struct buf *b;
+  struct bucket *h;
+
+  h = hash(dev, blockno);
+  acquire(&h->lock);
+  b = find(h, dev, blockno);
+  release(&h->lock);
+  if(b)
+    return;
+
+  acquire(&bcache.lock);
+  acquire(&h->lock);
+  b = find(h, dev, blockno);
+  release(&h->lock);
+  if(b || (b = evict()) == 0){
+    release(&bcache.lock);
+    return;
+  }
+  insert(b, dev, blockno);
+  release(&bcache.lock);
+
+  // Somebody who found the new buffer first may have read it.
+  acquiresleep(&b->lock);
+  if(b->flags & B_VALID){
+    brelse(b);
+    return;
   }
-  panic("bget: no buffers");
+  b->flags |= B_ASYNC;
+  iderw(b);
+}
+
+// Called by the disk driver when the B_ASYNC request for b has
+// finished: release b on behalf of the process that started it.
+void
+bdone(struct buf *b)
+{
+  b->flags &= ~B_ASYNC;
+  bput(b);
 }
 
 // Return a locked buf with the contents of the indicated block.
@@ -115,30 +517,99 @@ bwrite(struct buf *b)
   iderw(b);
 }
 
+// Start writing b's contents to disk, without waiting.
+// b must stay locked until bwait(b) returns.  Writes started
+// together can be merged into fewer disk commands.
+void
+bwritestart(struct buf *b)
+{
+  if(!holdingsleep(&b->lock))
+    panic("bwritestart");
+  b->flags |= B_DIRTY;
+  iderwstart(b);
+}
+
+// Wait for the write of b started by bwritestart().
+void
+bwait(struct buf *b)
+{
+  iderwwait(b);
+}
+
 // Release a locked buffer.
-// Move to the head of the MRU list.
 void
 brelse(struct buf *b)
 {
   if(!holdingsleep(&b->lock))
     panic("brelse");
+  bput(b);
+}
 
-  releasesleep(&b->lock);
+// Is block blockno of dev in the cache?
+// The answer may be stale as soon as it is returned
+// unless the caller keeps others from reading the block.
+int
+bcached(uint dev, uint blockno)
+{
+  struct bucket *h;
+  int r;
 
-  acquire(&bcache.lock);
+  h = hash(dev, blockno);
+  acquire(&h->lock);
+  r = find(h, dev, blockno) != 0;
+  release(&h->lock);
+  return r;
+}
+
+// Take an extra reference to b, which keeps it in the cache
+// after brelse() until the matching bunpin().
+void
+bpin(struct buf *b)
+{
+  struct bucket *h;
+
+  h = hash(b->dev, b->blockno);
+  acquire(&h->lock);
+  b->refcnt++;
+  release(&h->lock);
+}
+
+// Drop a reference to b taken by bpin() or bget().
+void
+bunpin(struct buf *b)
+{
+  struct bucket *h;
+  int unused;
+
+  h = hash(b->dev, b->blockno);
+  acquire(&h->lock);
   b->refcnt--;
-  if (b->refcnt == 0) {
-    // no one is waiting for it.
-    b->next->prev = b->prev;
-    b->prev->next = b->next;
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
-  }
-  
+  unused = b->refcnt == 0;
+  release(&h->lock);
+
+  if(unused && bcache.nwait > 0){
+    acquire(&bcache.lock);
+    wakeup(&bcache);
+    release(&bcache.lock);
+  }
+}
+
+// Copy the buffer cache statistics into *st.
+void
+bstat(struct bstat *st)
+{
+  struct bucket *h;
+
+  acquire(&bcache.lock);
+  st->nbuf = bcache.nbuf;
+  st->maxbuf = bcache.maxbuf;
+  st->misses = bcache.misses;
+  st->evictions = bcache.evictions;
+  st->waits = bcache.waits;
   release(&bcache.lock);
+  st->hits = 0;
+  for(h = bcache.bucket; h < bcache.bucket+NBUCKET; h++)
+    st->hits += h->hits;
 }
 //PAGEBREAK!
 // Blank page.
-
@@ -0,0 +1,22 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "bstat.h"
+
+// Print the buffer cache statistics.
+int
+main(int argc, char *argv[])
+{
+  struct bstat st;
+
+  if(bstat(&st) < 0){
+    printf(2, "bstat: failed\n");
+    exit();
+  }
+  printf(1, "buffers   %d of %d\n", st.nbuf, st.maxbuf);
+  printf(1, "hits      %d\n", st.hits);
+  printf(1, "misses    %d\n", st.misses);
+  printf(1, "evictions %d\n", st.evictions);
+  printf(1, "waits     %d\n", st.waits);
+  exit();
+}
@@ -0,0 +1,11 @@
+// Buffer cache statistics, filled in by bstat().
+// Both the kernel and user programs use this header file.
+
+struct bstat {
+  uint nbuf;       // buffers allocated so far
+  uint maxbuf;     // most buffers the cache will grow to
+  uint hits;       // lookups that found the block cached
+  uint misses;     // lookups that had to get a buffer
+  uint evictions;  // cached blocks dropped to make room
+  uint waits;      // misses that had to wait for a free buffer
+};
@@ -0,0 +1,169 @@
+// Directory name cache.
+//
+// The name cache remembers the results of recent directory
+// lookups, keyed by (dev, directory inode number, name), so
+// that resolving the same path again does not have to read
+// the directory's blocks.  It also remembers names that were
+// not found (negative entries), as for the commands the shell
+// tries to exec in the current directory first.
+//
+// Interface:
+// * dcachelookup() looks a name up in the cache.
+// * dcacheenter() records the result of a directory lookup,
+//   or a new directory entry made by dirlink().
+// * dcacheremove() forgets a name that has been unlinked.
+// * dcacheinval() forgets every name in a directory, for
+//   when the directory itself is freed.
+//
+// Callers hold the directory's lock, so the cache agrees with
+// what dirlookup() would find in the directory's blocks.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+
+#define NDHASH 61
+
+struct dentry {
+  uint dev;
+  uint dinum;            // directory inode number, 0 if this slot is free
+  char name[DIRSIZ];
+  uint inum;             // 0 if the name is not in the directory
+  uint off;              // offset of the name's dirent
+  uint lastuse;          // for LRU replacement
+  struct dentry *next;   // hash chain
+};
+
+struct {
+  struct spinlock lock;
+  struct dentry entry[NDCACHE];
+  struct dentry *hash[NDHASH];
+  uint clock;
+} dcache;
+
+void
+dcacheinit(void)
+{
+  initlock(&dcache.lock, "dcache");
+}
+
+static struct dentry**
+bucket(uint dev, uint dinum, char *name)
+{
+  uint h;
+  int i;
+
+  h = dev * 31 + dinum;
+  for(i = 0; i < DIRSIZ && name[i]; i++)
+    h = h * 31 + (uchar)name[i];
+  return &dcache.hash[h % NDHASH];
+}
+
+// Find the entry for name in dp.  Caller holds dcache.lock.
+static struct dentry*
+find(struct inode *dp, char *name)
+{
+  struct dentry *e;
+
+  for(e = *bucket(dp->dev, dp->inum, name); e; e = e->next)
+    if(e->dev == dp->dev && e->dinum == dp->inum && namecmp(e->name, name) == 0)
+      return e;
+  return 0;
+}
+
+// Take e off its hash chain and free it.
+// Caller holds dcache.lock.
+static void
+drop(struct dentry *e)
+{
+  struct dentry **pp;
+
+  for(pp = bucket(e->dev, e->dinum, e->name); *pp != e; pp = &(*pp)->next)
+    ;
+  *pp = e->next;
+  e->dinum = 0;
+}
+
+// Look up name in directory dp.  Returns 0 if the cache
+// doesn't know.  Otherwise returns 1 and sets *inum to the
+// name's inode number, or to 0 if dp has no such name, and
+// *off to the offset of its dirent.
+int
+dcachelookup(struct inode *dp, char *name, uint *inum, uint *off)
+{
+  struct dentry *e;
+
+  acquire(&dcache.lock);
+  if((e = find(dp, name)) == 0){
+    release(&dcache.lock);
+    return 0;
+  }
+  e->lastuse = ++dcache.clock;
+  *inum = e->inum;
+  *off = e->off;
+  release(&dcache.lock);
+  return 1;
+}
+
+// Remember that name is at offset off in directory dp
+// and refers to inode inum, or that dp has no entry
+// for name if inum is 0.
+void
+dcacheenter(struct inode *dp, char *name, uint inum, uint off)
+{
+  struct dentry *e, *f, **h;
+
+  acquire(&dcache.lock);
+  if((e = find(dp, name)) == 0){
+    // Use a free slot or the least recently used one.
+    for(e = dcache.entry; e < &dcache.entry[NDCACHE]; e++)
+      if(e->dinum == 0)
+        break;
+    if(e == &dcache.entry[NDCACHE]){
+      e = dcache.entry;
+      for(f = dcache.entry; f < &dcache.entry[NDCACHE]; f++)
+        if(f->lastuse < e->lastuse)
+          e = f;
+      drop(e);
+    }
+    e->dev = dp->dev;
+    e->dinum = dp->inum;
+    strncpy(e->name, name, DIRSIZ);
+    h = bucket(dp->dev, dp->inum, name);
+    e->next = *h;
+    *h = e;
+  }
+  e->inum = inum;
+  e->off = off;
+  e->lastuse = ++dcache.clock;
+  release(&dcache.lock);
+}
+
+// Forget name in directory dp, which has been unlinked.
+void
+dcacheremove(struct inode *dp, char *name)
+{
+  struct dentry *e;
+
+  acquire(&dcache.lock);
+  if((e = find(dp, name)) != 0)
+    drop(e);
+  release(&dcache.lock);
+}
+
+// Forget all names in directory dp, which is being freed.
+void
+dcacheinval(struct inode *dp)
+{
+  struct dentry *e;
+
+  acquire(&dcache.lock);
+  for(e = dcache.entry; e < &dcache.entry[NDCACHE]; e++)
+    if(e->dinum == dp->inum && e->dev == dp->dev)
+      drop(e);
+  release(&dcache.lock);
+}
@@ -1,7 +1,9 @@
 struct buf;
+struct bstat;
 struct context;
 struct file;
 struct inode;
+struct pcidev;
 struct pipe;
 struct proc;
 struct rtcdate;
@@ -10,11 +12,22 @@ struct sleeplock;
 struct stat;
 struct superblock;
 struct condvar;
+struct vma;
+struct shmseg;
+struct work;
 
 // bio.c
 void            binit(void);
 struct buf*     bread(uint, uint);
 void            brelse(struct buf*);
+void            bstat(struct bstat*);
+void            bprefetch(uint, uint);
+void            bwritestart(struct buf*);
+void            bwait(struct buf*);
+void            bdone(struct buf*);
+void            bpin(struct buf*);
+int             bcached(uint, uint);
+void            bunpin(struct buf*);
 void            bwrite(struct buf*);
 
 // console.c
@@ -26,6 +39,13 @@ void            panic(char*) __attribute__((noreturn));
 // exec.c
 int             exec(char*, char**);
 
+// dcache.c
+void            dcacheinit(void);
+void            dcacheenter(struct inode*, char*, uint, uint);
+void            dcacheinval(struct inode*);
+int             dcachelookup(struct inode*, char*, uint*, uint*);
+void            dcacheremove(struct inode*, char*);
+
 // file.c
 struct file*    filealloc(void);
 void            fileclose(struct file*);
@@ -39,6 +59,7 @@ int             filewrite(struct file*, char*, int n);
 void            readsb(int dev, struct superblock *sb);
 int             dirlink(struct inode*, char*, uint);
 struct inode*   dirlookup(struct inode*, char*, uint*);
+void            dirunlink(struct inode*, char*, uint);
 struct inode*   ialloc(uint, short);
 struct inode*   idup(struct inode*);
 void            iinit(int dev);
@@ -49,15 +70,24 @@ void            iunlockput(struct inode*);
 void            iupdate(struct inode*);
 int             namecmp(const char*, const char*);
 struct inode*   namei(char*);
+int             mount(char*, uint);
+int             ismount(struct inode*);
 struct inode*   nameiparent(char*, char*);
 int             readi(struct inode*, char*, uint, uint);
+int             readidisk(struct inode*, char*, uint, uint);
+void            ireadahead(struct inode*, uint, uint);
 void            stati(struct inode*, struct stat*);
 int             writei(struct inode*, char*, uint, uint);
+int             writeidelay(struct inode*, char*, uint, uint);
+void            iflush(struct inode*);
+void            iflushall(void);
 
 // ide.c
 void            ideinit(void);
 void            ideintr(void);
 void            iderw(struct buf*);
+void            iderwstart(struct buf*);
+void            iderwwait(struct buf*);
 
 // ioapic.c
 void            ioapicenable(int irq, int cpu);
@@ -69,6 +99,11 @@ char*           kalloc(void);
 void            kfree(char*);
 void            kinit1(void*, void*);
 void            kinit2(void*, void*);
+void            kincref(char*);
+int             krefcnt(char*);
+char*           kallocsuper(void);
+void            ksuperincref(char*);
+void            kfreesuper(char*);
 
 // kbd.c
 void            kbdintr(void);
@@ -85,13 +120,36 @@ void            microdelay(int);
 // log.c
 void            initlog(int dev);
 void            log_write(struct buf*);
+void            log_free(uint);
+int             log_freed(uint);
 void            begin_op();
+void            begin_opn(int);
+void            begin_write(int);
+int             logwritemax(void);
 void            end_op();
+void            logforce(void);
 
 // mp.c
 extern int      ismp;
 void            mpinit(void);
 
+// pcache.c
+void            pcacheinit(void);
+char*           pcacheget(struct inode*, uint);
+char*           pcacheshared(struct inode*, uint);
+void            pcacheinval(struct inode*);
+int             pcachereclaim(void);
+char*           pcachedirty(struct inode*, uint);
+char*           pcacheclean(struct inode*, uint*);
+int             pcachendirty(void);
+void            pcachewrite(struct inode*, char*, uint, uint);
+
+// pci.c
+uint            pciread(struct pcidev*, int);
+void            pciwrite(struct pcidev*, int, uint);
+int             pcifind(int, int, int, int, struct pcidev*);
+void            pcienable(struct pcidev*);
+
 // picirq.c
 void            picenable(int);
 void            picinit(void);
@@ -109,6 +167,8 @@ void            exit(void);
 int             fork(void);
 int             growproc(int);
 int             kill(int);
+struct proc*    kthread_create(void (*)(void*), void*, char*);
+void            kthread_exit(void);
 struct cpu*     mycpu(void);
 struct proc*    myproc();
 void            pinit(void);
@@ -145,6 +205,16 @@ void            release(struct spinlock*);
 void            pushcli(void);
 void            popcli(void);
 
+// shm.c
+void            shminit(void);
+int             shmget(int, uint);
+int             shmat(int);
+int             shmdt(uint);
+int             shmrm(int);
+char*           shmpage(struct shmseg*, uint);
+void            shmdup(struct shmseg*);
+void            shmput(struct shmseg*);
+
 // sleeplock.c
 void            acquiresleep(struct sleeplock*);
 void            releasesleep(struct sleeplock*);
@@ -171,6 +241,16 @@ void            syscall(void);
 // timer.c
 void            timerinit(void);
 
+// tmpfs.c
+void            tmpfsinit(void);
+uint            tmpialloc(short);
+void            tmpiload(struct inode*);
+void            tmpiupdate(struct inode*);
+void            tmpitrunc(struct inode*);
+char*           tmppage(struct inode*, uint);
+int             tmpread(struct inode*, char*, uint, uint);
+int             tmpwrite(struct inode*, char*, uint, uint);
+
 // trap.c
 void            idtinit(void);
 extern uint     ticks;
@@ -182,11 +262,18 @@ void            uartinit(void);
 void            uartintr(void);
 void            uartputc(int);
 
+// virtio.c
+int             virtioinit(void);
+int             virtiointr(int);
+void            virtiorwstart(struct buf*);
+void            virtiorwwait(struct buf*);
+
 // vm.c
 void            seginit(void);
 void            kvmalloc(void);
 pde_t*          setupkvm(void);
 char*           uva2ka(pde_t*, char*);
+char*           uvaddr(struct proc*, uint, int);
 int             allocuvm(pde_t*, uint, uint);
 int             deallocuvm(pde_t*, uint, uint);
 void            freevm(pde_t*);
@@ -197,6 +284,21 @@ void            switchuvm(struct proc*);
 void            switchkvm(void);
 int             copyout(pde_t*, uint, void*, uint);
 void            clearpteu(pde_t *pgdir, char *uva);
+int             vmfault(struct proc*, uint, uint);
+int             vmtouch(struct proc*, uint, uint);
+struct vma*     vmalookup(struct proc*, uint, uint);
+struct vma*     vmareserve(struct proc*, uint, uint, uint);
+int             vmacopy(pde_t*, pde_t*, struct vma*);
+void            freevma(pde_t*, struct vma*);
+int             mmap(uint, uint, int, int, struct file*, uint);
+int             munmap(uint, uint);
+
+// workq.c
+void            workinit(void);
+void            initwork(struct work*, void (*)(void*), void*);
+int             queuework(struct work*);
+int             workafter(struct work*, int);
+void            worktick(void);
 
 // number of elements in fixed-size array
 #define NELEM(x) (sizeof(x)/sizeof((x)[0]))
@@ -5,6 +5,7 @@
 #include "types.h"
 #include "defs.h"
 #include "param.h"
+#include "stat.h"
 #include "fs.h"
 #include "spinlock.h"
 #include "sleeplock.h"
@@ -72,6 +73,8 @@ fileclose(struct file *f)
 
   if(ff.type == FD_PIPE)
     pipeclose(ff.pipe, ff.writable);
+  else if(ff.type == FD_INODE && ff.ip->dev == TMPDEV)
+    iput(ff.ip);  // writes nothing to the log
   else if(ff.type == FD_INODE){
     begin_op();
     iput(ff.ip);
@@ -104,8 +107,28 @@ fileread(struct file *f, char *addr, int n)
     return piperead(f->pipe, addr, n);
   if(f->type == FD_INODE){
     ilock(f->ip);
-    if((r = readi(f->ip, addr, f->off, n)) > 0)
+    if((r = readi(f->ip, addr, f->off, n)) > 0){
+      // Read ahead of a reader that continues where its last
+      // read ended, doubling the window each time.
+      if(f->off == f->raoff){
+        f->rawin = f->rawin ? 2*f->rawin : 4;
+        if(f->rawin > MAXREADAHEAD)
+          f->rawin = MAXREADAHEAD;
+      } else {
+        f->rawin = 0;
+        f->raend = 0;
+      }
       f->off += r;
+      f->raoff = f->off;
+      if(f->rawin){
+        if(f->raend < f->off)
+          f->raend = f->off;
+        if(f->raend < f->off + f->rawin*BSIZE){
+          ireadahead(f->ip, f->raend, f->off + f->rawin*BSIZE - f->raend);
+          f->raend = f->off + f->rawin*BSIZE;
+        }
+      }
+    }
     iunlock(f->ip);
     return r;
   }
@@ -124,21 +147,52 @@ filewrite(struct file *f, char *addr, int n)
   if(f->type == FD_PIPE)
     return pipewrite(f->pipe, addr, n);
   if(f->type == FD_INODE){
-    // write a few blocks at a time to avoid exceeding
-    // the maximum log transaction size, including
-    // i-node, indirect block, allocation blocks,
-    // and 2 blocks of slop for non-aligned writes.
+    int i = 0;
+    if(f->ip->dev == TMPDEV){
+      // The RAM file system needs no log transaction.
+      ilock(f->ip);
+      if((r = writei(f->ip, addr, f->off, n)) > 0)
+        f->off += r;
+      iunlock(f->ip);
+      return r == n ? n : -1;
+    }
+    if(f->wback && f->ip->type == T_FILE){
+      // Buffer the write in the page cache.  If dirty pages
+      // are taking over the cache, write them back first.
+      if(pcachendirty() >= NPCACHE/2)
+        iflushall();
+      ilock(f->ip);
+      if((r = writeidelay(f->ip, addr, f->off, n)) > 0){
+        f->off += r;
+        i = r;
+      }
+      iunlock(f->ip);
+      if(r < 0)
+        return -1;
+      // Whatever the page cache couldn't take is written
+      // through, below.
+    }
+
+    // write up to half the log at a time to avoid exceeding
+    // the maximum log transaction size; begin_write()
+    // reserves the blocks a write of n1 bytes may touch.
     // this really belongs lower down, since writei()
     // might be writing a device like the console.
-    int max = ((MAXOPBLOCKS-1-1-2) / 2) * 512;
-    int i = 0;
+    int max = logwritemax();
     while(i < n){
       int n1 = n - i;
       if(n1 > max)
         n1 = max;
 
-      begin_op();
+      begin_write(n1);
       ilock(f->ip);
+      if(f->ip->size != f->ip->dsize){
+        // Delayed writes must reach the disk first.
+        iunlock(f->ip);
+        end_op();
+        iflush(f->ip);
+        continue;
+      }
       if ((r = writei(f->ip, addr + i, f->off, n1)) > 0)
         f->off += r;
       iunlock(f->ip);
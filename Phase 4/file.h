@@ -6,6 +6,10 @@ struct file {
   struct pipe *pipe;
   struct inode *ip;
   uint off;
+  uint raoff;  // offset where the last read ended
+  uint rawin;  // read-ahead window, in blocks
+  uint raend;  // read-ahead has been started up to here
+  char wback;  // opened O_WBACK: buffer writes in the page cache
 };
 
 
@@ -14,6 +18,10 @@ struct inode {
   uint dev;           // Device number
   uint inum;          // Inode number
   int ref;            // Reference count
+  struct inode *hnext; // hash chain
+  struct inode *prev; // LRU list of unreferenced inodes
+  struct inode *next;
+  struct inode *dnext; // list of inodes with delayed writes
   struct sleeplock lock; // protects everything below here
   int valid;          // inode has been read from disk?
 
@@ -22,7 +30,15 @@ struct inode {
   short minor;
   short nlink;
   uint size;
-  uint addrs[NDIRECT+1];
+  uint flags;
+  uint addrs[NDIRECT+2];
+
+  uint extbn;         // file blocks [extbn, extbn+extlen)
+  uint extaddr;       // are at disk blocks [extaddr, extaddr+extlen)
+  uint extlen;
+
+  uint dsize;         // size on disk; data beyond is only in the page cache
+  int delayed;        // on icache.delayed, which holds a reference
 };
 
 // table mapping major device number to
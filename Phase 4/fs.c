@@ -13,19 +13,23 @@
 #include "defs.h"
 #include "param.h"
 #include "stat.h"
+#include "memlayout.h"
 #include "mmu.h"
+#include "x86.h"
 #include "proc.h"
 #include "spinlock.h"
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
 #include "file.h"
+#include "work.h"
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
 static void itrunc(struct inode*);
 // there should be one superblock per disk device, but we run with
 // only one device
 struct superblock sb; 
+uint bcursor;  // where balloc() starts looking, likewise
 
 // Read the super block.
 void
@@ -52,31 +56,78 @@ bzero(int dev, int bno)
 
 // Blocks.
 
-// Allocate a zeroed disk block.
+// Return the first free bit at or after bi and before
+// nbits in bitmap block data, or -1 if there is none.
+// Looks at a 32-bit word at a time.
+static int
+freebit(uchar *data, int bi, int nbits)
+{
+  uint *w, x;
+
+  w = (uint*)data;
+  for(; bi < nbits; bi = (bi/32 + 1) * 32){
+    x = ~w[bi/32] & (~0U << (bi%32));
+    if(x){
+      bi = (bi/32) * 32 + bsf(x);
+      return bi < nbits ? bi : -1;
+    }
+  }
+  return -1;
+}
+
+// Allocate up to *n disk blocks in a row, starting at the
+// first free block at or after goal, or after bcursor if
+// goal is 0.  Sets *n to the number allocated, which is at
+// least 1, and returns the first of them.  The blocks are
+// zeroed unless the caller is going to overwrite them.
+// Blocks freed by a transaction that hasn't committed yet
+// are zeroed through the log even then, which keeps the
+// caller from writing them directly (see writei()).
 static uint
-balloc(uint dev)
+balloc_n(uint dev, uint goal, uint *n, int zero)
 {
-  int b, bi, m;
+  int b, bi, k, nbits, nbmap, len;
   struct buf *bp;
 
-  bp = 0;
-  for(b = 0; b < sb.size; b += BPB){
+  if(goal == 0 || goal >= sb.size)
+    goal = bcursor < sb.size ? bcursor : 0;
+  nbmap = (sb.size + BPB - 1) / BPB;
+  // Visit the bitmap block holding goal last
+  // again, for the blocks before goal.
+  for(k = 0; k <= nbmap; k++){
+    b = ((goal / BPB + k) % nbmap) * BPB;
+    nbits = min(BPB, sb.size - b);
     bp = bread(dev, BBLOCK(b, sb));
-    for(bi = 0; bi < BPB && b + bi < sb.size; bi++){
-      m = 1 << (bi % 8);
-      if((bp->data[bi/8] & m) == 0){  // Is block free?
-        bp->data[bi/8] |= m;  // Mark block in use.
-        log_write(bp);
-        brelse(bp);
-        bzero(dev, b + bi);
-        return b + bi;
+    if((bi = freebit(bp->data, k == 0 ? goal % BPB : 0, nbits)) >= 0){
+      for(len = 0; len < *n && bi + len < nbits; len++){
+        if(bp->data[(bi+len)/8] & (1 << ((bi+len) % 8)))
+          break;
+        bp->data[(bi+len)/8] |= 1 << ((bi+len) % 8);  // Mark block in use.
       }
+      log_write(bp);
+      brelse(bp);
+      for(k = 0; k < len; k++)
+        if(zero || log_freed(b + bi + k))
+          bzero(dev, b + bi + k);
+      bcursor = b + bi + len;
+      *n = len;
+      return b + bi;
     }
     brelse(bp);
   }
   panic("balloc: out of blocks");
 }
 
+// Allocate a zeroed disk block.
+static uint
+balloc(uint dev)
+{
+  uint n;
+
+  n = 1;
+  return balloc_n(dev, 0, &n, 1);
+}
+
 // Free a disk block.
 static void
 bfree(int dev, uint b)
@@ -92,6 +143,7 @@ bfree(int dev, uint b)
   bp->data[bi/8] &= ~m;
   log_write(bp);
   brelse(bp);
+  log_free(b);
 }
 
 // Inodes.
@@ -154,31 +206,94 @@ bfree(int dev, uint b)
 // have locked the inodes involved; this lets callers create
 // multi-step atomic operations.
 //
+// The cache is sized at boot from the amount of memory (but no
+// larger than the number of i-nodes on disk).  Entries are hashed
+// by (dev, inum), so iget() finds a cached inode in constant time.
+// An entry whose ref has fallen to zero stays in the cache, and
+// valid, on an LRU list; iget() recycles the least recently used
+// one when it needs a new entry.
+//
+// Writes to files opened with O_WBACK are delayed: writeidelay()
+// only puts the data in dirty page cache pages and grows
+// ip->size, without allocating blocks or starting a transaction.
+// ip->dsize is the size of the file on disk, which iupdate()
+// writes.  An inode with delayed writes is on the icache.delayed
+// list, which holds a reference to it, until iflush() writes its
+// dirty pages back, allocating their blocks in as few
+// transactions as the log allows.  A kworker does that every
+// FLUSHTICKS, and fsync() for a single file.
+//
 // The icache.lock spin-lock protects the allocation of icache
 // entries. Since ip->ref indicates whether an entry is free,
 // and ip->dev and ip->inum indicate which i-node an entry
-// holds, one must hold icache.lock while using any of those fields.
+// holds, one must hold icache.lock while using any of those fields,
+// or the hash chains, LRU list and delayed list.
 //
 // An ip->lock sleep-lock protects all ip-> fields other than ref,
 // dev, and inum.  One must hold ip->lock in order to
 // read or write that inode's ip->valid, ip->size, ip->type, &c.
 
+#define NIHASH 61
+
+extern char end[]; // first address after kernel loaded from ELF file
+
 struct {
   struct spinlock lock;
-  struct inode inode[NINODE];
+  struct inode *hash[NIHASH];
+  struct inode lru;   // lru.next is most recently used
+  int ninode;
+  struct inode *delayed;  // inodes with delayed writes
+  int ndelayed;
 } icache;
 
+static struct work flushwork;
+static void flush(void*);
+
+// Read-ahead requests handed to the kworkers.
+struct rawork {
+  struct work work;
+  struct inode *ip;   // 0 if this slot is free
+  uint off;
+  uint n;
+};
+
+struct {
+  struct spinlock lock;
+  struct rawork req[NRAWORK];
+} ratab;
+
 void
 iinit(int dev)
 {
-  int i = 0;
-  
+  struct inode *ip;
+  int n;
+
   initlock(&icache.lock, "icache");
-  for(i = 0; i < NINODE; i++) {
-    initsleeplock(&icache.inode[i].lock, "inode");
-  }
+  initlock(&ratab.lock, "ratab");
+  initwork(&flushwork, flush, 0);
+  workafter(&flushwork, FLUSHTICKS);
+  icache.lru.prev = &icache.lru;
+  icache.lru.next = &icache.lru;
 
   readsb(dev, &sb);
+  n = (PHYSTOP - V2P(end)) / 64 / sizeof(struct inode);
+  if(n > sb.ninodes)
+    n = sb.ninodes;
+  if(n < NINODE)
+    n = NINODE;
+  ip = 0;
+  for(; icache.ninode < n; icache.ninode++, ip++){
+    if(icache.ninode % (PGSIZE/sizeof(*ip)) == 0 &&
+       (ip = (struct inode*)kalloc()) == 0)
+      panic("iinit");
+    memset(ip, 0, sizeof(*ip));
+    initsleeplock(&ip->lock, "inode");
+    ip->next = icache.lru.next;
+    ip->prev = &icache.lru;
+    icache.lru.next->prev = ip;
+    icache.lru.next = ip;
+  }
+
   cprintf("sb: size %d nblocks %d ninodes %d nlog %d logstart %d\
  inodestart %d bmap start %d\n", sb.size, sb.nblocks,
           sb.ninodes, sb.nlog, sb.logstart, sb.inodestart,
@@ -190,7 +305,8 @@ static struct inode* iget(uint dev, uint inum);
 //PAGEBREAK!
 // Allocate an inode on device dev.
 // Mark it as allocated by  giving it type type.
-// Returns an unlocked but allocated and referenced inode.
+// Returns an unlocked but allocated and referenced inode,
+// or 0 if the RAM file system has no free inode.
 struct inode*
 ialloc(uint dev, short type)
 {
@@ -198,6 +314,11 @@ ialloc(uint dev, short type)
   struct buf *bp;
   struct dinode *dip;
 
+  if(dev == TMPDEV){
+    if((inum = tmpialloc(type)) == 0)
+      return 0;
+    return iget(dev, inum);
+  }
   for(inum = 1; inum < sb.ninodes; inum++){
     bp = bread(dev, IBLOCK(inum, sb));
     dip = (struct dinode*)bp->data + inum%IPB;
@@ -223,49 +344,74 @@ iupdate(struct inode *ip)
   struct buf *bp;
   struct dinode *dip;
 
+  if(ip->dev == TMPDEV){
+    tmpiupdate(ip);
+    return;
+  }
   bp = bread(ip->dev, IBLOCK(ip->inum, sb));
   dip = (struct dinode*)bp->data + ip->inum%IPB;
   dip->type = ip->type;
   dip->major = ip->major;
   dip->minor = ip->minor;
   dip->nlink = ip->nlink;
-  dip->size = ip->size;
+  dip->size = ip->dsize;
+  dip->flags = ip->flags;
   memmove(dip->addrs, ip->addrs, sizeof(ip->addrs));
   log_write(bp);
   brelse(bp);
 }
 
+static struct inode**
+ihash(uint dev, uint inum)
+{
+  return &icache.hash[(dev * 31 + inum) % NIHASH];
+}
+
+// Take a reference to ip.  Caller holds icache.lock.
+static void
+iref(struct inode *ip)
+{
+  if(ip->ref++ == 0){
+    ip->prev->next = ip->next;
+    ip->next->prev = ip->prev;
+  }
+}
+
 // Find the inode with number inum on device dev
 // and return the in-memory copy. Does not lock
 // the inode and does not read it from disk.
 static struct inode*
 iget(uint dev, uint inum)
 {
-  struct inode *ip, *empty;
+  struct inode *ip, **pp;
 
   acquire(&icache.lock);
 
   // Is the inode already cached?
-  empty = 0;
-  for(ip = &icache.inode[0]; ip < &icache.inode[NINODE]; ip++){
-    if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
-      ip->ref++;
+  for(ip = *ihash(dev, inum); ip; ip = ip->hnext){
+    if(ip->dev == dev && ip->inum == inum){
+      iref(ip);
       release(&icache.lock);
       return ip;
     }
-    if(empty == 0 && ip->ref == 0)    // Remember empty slot.
-      empty = ip;
   }
 
-  // Recycle an inode cache entry.
-  if(empty == 0)
+  // Recycle the least recently used inode cache entry.
+  ip = icache.lru.prev;
+  if(ip == &icache.lru)
     panic("iget: no inodes");
-
-  ip = empty;
+  if(ip->inum != 0){
+    for(pp = ihash(ip->dev, ip->inum); *pp != ip; pp = &(*pp)->hnext)
+      ;
+    *pp = ip->hnext;
+  }
+  iref(ip);
   ip->dev = dev;
   ip->inum = inum;
-  ip->ref = 1;
   ip->valid = 0;
+  pp = ihash(dev, inum);
+  ip->hnext = *pp;
+  *pp = ip;
   release(&icache.lock);
 
   return ip;
@@ -277,7 +423,7 @@ struct inode*
 idup(struct inode *ip)
 {
   acquire(&icache.lock);
-  ip->ref++;
+  iref(ip);
   release(&icache.lock);
   return ip;
 }
@@ -295,6 +441,10 @@ ilock(struct inode *ip)
 
   acquiresleep(&ip->lock);
 
+  if(ip->valid == 0 && ip->dev == TMPDEV){
+    tmpiload(ip);
+    ip->valid = 1;
+  }
   if(ip->valid == 0){
     bp = bread(ip->dev, IBLOCK(ip->inum, sb));
     dip = (struct dinode*)bp->data + ip->inum%IPB;
@@ -303,7 +453,10 @@ ilock(struct inode *ip)
     ip->minor = dip->minor;
     ip->nlink = dip->nlink;
     ip->size = dip->size;
+    ip->dsize = ip->size;
+    ip->flags = dip->flags;
     memmove(ip->addrs, dip->addrs, sizeof(ip->addrs));
+    ip->extlen = 0;
     brelse(bp);
     ip->valid = 1;
     if(ip->type == 0)
@@ -323,7 +476,7 @@ iunlock(struct inode *ip)
 
 // Drop a reference to an in-memory inode.
 // If that was the last reference, the inode cache entry can
-// be recycled.
+// be recycled, but stays cached until it is.
 // If that was the last reference and the inode has no links
 // to it, free the inode (and its content) on disk.
 // All calls to iput() must be inside a transaction in
@@ -338,6 +491,8 @@ iput(struct inode *ip)
     release(&icache.lock);
     if(r == 1){
       // inode has no links and no other references: truncate and free.
+      if(ip->type == T_DIR)
+        dcacheinval(ip);
       itrunc(ip);
       ip->type = 0;
       iupdate(ip);
@@ -347,7 +502,12 @@ iput(struct inode *ip)
   releasesleep(&ip->lock);
 
   acquire(&icache.lock);
-  ip->ref--;
+  if(--ip->ref == 0){
+    ip->next = icache.lru.next;
+    ip->prev = &icache.lru;
+    icache.lru.next->prev = ip;
+    icache.lru.next = ip;
+  }
   release(&icache.lock);
 }
 
@@ -365,40 +525,143 @@ iunlockput(struct inode *ip)
 // The content (data) associated with each inode is stored
 // in blocks on the disk. The first NDIRECT block numbers
 // are listed in ip->addrs[].  The next NINDIRECT blocks are
-// listed in block ip->addrs[NDIRECT].
+// listed in block ip->addrs[NDIRECT].  The last NDINDIRECT
+// blocks are listed in the NINDIRECT blocks that are listed
+// in block ip->addrs[NDIRECT+1].
+//
+// ip->extbn, extaddr and extlen cache the extent (run of
+// consecutive disk blocks) starting at the last block that
+// bmap() looked up, so that sequential access only reads
+// an indirect block once per extent.
+
+// Remember the extent that starts at file block bn, whose
+// block number is a[0], with a[1..n-1] those of the following
+// blocks mapped by the same block.
+static void
+setext(struct inode *ip, uint bn, uint *a, uint n)
+{
+  uint len;
 
-// Return the disk block address of the nth block in inode ip.
-// If there is no such block, bmap allocates one.
+  for(len = 1; len < n && a[len] == a[0] + len; len++)
+    ;
+  ip->extbn = bn;
+  ip->extaddr = a[0];
+  ip->extlen = len;
+}
+
+// Return entry i of the block-number block addr, setting
+// it to new, or to a newly allocated block if new is 0,
+// if necessary.  Sets the extent cache to the extent
+// starting at file block bn if ext is set.
 static uint
-bmap(struct inode *ip, uint bn)
+bmapind(struct inode *ip, uint addr, uint i, uint new, uint bn, int ext)
 {
-  uint addr, *a;
   struct buf *bp;
+  uint *a;
+
+  bp = bread(ip->dev, addr);
+  a = (uint*)bp->data;
+  if((addr = a[i]) == 0){
+    a[i] = addr = new ? new : balloc(ip->dev);
+    log_write(bp);
+  }
+  if(ext)
+    setext(ip, bn, a + i, NINDIRECT - i);
+  brelse(bp);
+  return addr;
+}
+
+// Return the disk block address of the nth block in inode ip.
+// If there is no such block, map it to disk block new,
+// or to a newly allocated one if new is 0.
+static uint
+bmapnew(struct inode *ip, uint bn, uint new)
+{
+  uint addr;
+
+  if(bn - ip->extbn < ip->extlen)
+    return ip->extaddr + (bn - ip->extbn);
 
   if(bn < NDIRECT){
     if((addr = ip->addrs[bn]) == 0)
-      ip->addrs[bn] = addr = balloc(ip->dev);
+      ip->addrs[bn] = addr = new ? new : balloc(ip->dev);
+    setext(ip, bn, ip->addrs + bn, NDIRECT - bn);
     return addr;
   }
-  bn -= NDIRECT;
 
-  if(bn < NINDIRECT){
+  if(bn < NDIRECT + NINDIRECT){
     // Load indirect block, allocating if necessary.
     if((addr = ip->addrs[NDIRECT]) == 0)
       ip->addrs[NDIRECT] = addr = balloc(ip->dev);
-    bp = bread(ip->dev, addr);
-    a = (uint*)bp->data;
-    if((addr = a[bn]) == 0){
-      a[bn] = addr = balloc(ip->dev);
-      log_write(bp);
-    }
-    brelse(bp);
-    return addr;
+    return bmapind(ip, addr, bn - NDIRECT, new, bn, 1);
+  }
+
+  if(bn < MAXFILE){
+    // Load the double-indirect block, then the
+    // indirect block, allocating if necessary.
+    if((addr = ip->addrs[NDIRECT+1]) == 0)
+      ip->addrs[NDIRECT+1] = addr = balloc(ip->dev);
+    bn -= NDIRECT + NINDIRECT;
+    addr = bmapind(ip, addr, bn / NINDIRECT, 0, 0, 0);
+    return bmapind(ip, addr, bn % NINDIRECT, new, bn + NDIRECT + NINDIRECT, 1);
   }
 
   panic("bmap: out of range");
 }
 
+// Return the disk block address of the nth block in inode ip.
+// If there is no such block, bmap allocates one.
+static uint
+bmap(struct inode *ip, uint bn)
+{
+  return bmapnew(ip, bn, 0);
+}
+
+// Allocate file blocks [bn, end) of ip, which must not have
+// been allocated yet, as few runs of consecutive disk blocks,
+// the first one right after file block bn-1 if possible.
+// The blocks are zeroed unless zero is 0.
+static void
+bmaprun(struct inode *ip, uint bn, uint end, int zero)
+{
+  uint addr, goal, n, i;
+
+  if(bn >= end)
+    return;
+  goal = bn > 0 ? bmap(ip, bn - 1) + 1 : 0;
+  while(bn < end){
+    n = end - bn;
+    addr = balloc_n(ip->dev, goal, &n, zero);
+    for(i = 0; i < n; i++)
+      bmapnew(ip, bn + i, addr + i);
+    bn += n;
+    goal = addr + n;
+  }
+}
+
+// Free the data blocks listed in block-number block addr,
+// and the lists they point to if depth > 0, then addr itself.
+static void
+bfreeind(struct inode *ip, uint addr, int depth)
+{
+  struct buf *bp;
+  uint *a;
+  int j;
+
+  bp = bread(ip->dev, addr);
+  a = (uint*)bp->data;
+  for(j = 0; j < NINDIRECT; j++){
+    if(a[j] == 0)
+      continue;
+    if(depth > 0)
+      bfreeind(ip, a[j], depth - 1);
+    else
+      bfree(ip->dev, a[j]);
+  }
+  brelse(bp);
+  bfree(ip->dev, addr);
+}
+
 // Truncate inode (discard contents).
 // Only called when the inode has no links
 // to it (no directory entries referring to it)
@@ -407,10 +670,16 @@ bmap(struct inode *ip, uint bn)
 static void
 itrunc(struct inode *ip)
 {
-  int i, j;
-  struct buf *bp;
-  uint *a;
+  int i;
 
+  pcacheinval(ip);
+  if(ip->dev == TMPDEV){
+    tmpitrunc(ip);
+    ip->size = 0;
+    ip->dsize = 0;
+    iupdate(ip);
+    return;
+  }
   for(i = 0; i < NDIRECT; i++){
     if(ip->addrs[i]){
       bfree(ip->dev, ip->addrs[i]);
@@ -419,18 +688,17 @@ itrunc(struct inode *ip)
   }
 
   if(ip->addrs[NDIRECT]){
-    bp = bread(ip->dev, ip->addrs[NDIRECT]);
-    a = (uint*)bp->data;
-    for(j = 0; j < NINDIRECT; j++){
-      if(a[j])
-        bfree(ip->dev, a[j]);
-    }
-    brelse(bp);
-    bfree(ip->dev, ip->addrs[NDIRECT]);
+    bfreeind(ip, ip->addrs[NDIRECT], 0);
     ip->addrs[NDIRECT] = 0;
   }
+  if(ip->addrs[NDIRECT+1]){
+    bfreeind(ip, ip->addrs[NDIRECT+1], 1);
+    ip->addrs[NDIRECT+1] = 0;
+  }
 
+  ip->extlen = 0;
   ip->size = 0;
+  ip->dsize = 0;
   iupdate(ip);
 }
 
@@ -447,13 +715,91 @@ stati(struct inode *ip, struct stat *st)
 }
 
 //PAGEBREAK!
-// Read data from inode.
+// Transfer the whole blocks of ip starting at offset off,
+// which must be block-aligned, directly between the disk and
+// the memory at addr, for at most n bytes: into addr, or
+// from it if write is set.  addr may be a user address or
+// a kernel page, such as one being filled by the page cache.
+// Stops at the first block that is in the buffer cache or
+// whose memory isn't usable, and returns the number of bytes
+// transferred.
+// Caller must hold ip->lock, so that nobody else brings
+// the blocks into the buffer cache meanwhile.
+static uint
+idirect(struct inode *ip, char *addr, uint off, uint n, int write)
+{
+  struct buf *b;
+  char *ka;
+  uint i, j, blockno;
+
+  if(off % BSIZE != 0 || n < BSIZE)
+    return 0;
+  if((uint)addr < KERNBASE && myproc() == 0)
+    return 0;
+  b = 0;
+  n = min(n / BSIZE, PGSIZE / sizeof(*b));
+  for(i = 0; i < n; i++, addr += BSIZE){
+    if(PGROUNDDOWN((uint)addr) != PGROUNDDOWN((uint)addr + BSIZE - 1))
+      break;
+    if((uint)addr >= KERNBASE)
+      ka = addr;
+    else if((ka = uvaddr(myproc(), (uint)addr, !write)) == 0)
+      break;
+    blockno = bmap(ip, off/BSIZE + i);
+    if(bcached(ip->dev, blockno))
+      break;
+    if(b == 0 && (b = (struct buf*)kalloc()) == 0)
+      break;
+    memset(&b[i], 0, sizeof(b[i]));
+    initsleeplock(&b[i].lock, "direct");
+    acquiresleep(&b[i].lock);
+    b[i].dev = ip->dev;
+    b[i].blockno = blockno;
+    b[i].data = (uchar*)ka;
+    b[i].flags = write ? B_DIRTY : 0;
+    iderwstart(&b[i]);
+  }
+  for(j = 0; j < i; j++){
+    iderwwait(&b[j]);
+    releasesleep(&b[j].lock);
+  }
+  if(b)
+    kfree((char*)b);
+  return i * BSIZE;
+}
+
+// Read n bytes at offset off of ip from its blocks, without
+// going through the page cache.  Used to fill page cache
+// pages, and for directories.
+// Caller must hold ip->lock and have checked off and n.
+int
+readidisk(struct inode *ip, char *dst, uint off, uint n)
+{
+  uint tot, m;
+  struct buf *bp;
+
+  if(ip->dev == TMPDEV)
+    return tmpread(ip, dst, off, n);
+  for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
+    if((m = idirect(ip, dst, off, n - tot, 0)) > 0)
+      continue;
+    bp = bread(ip->dev, bmap(ip, off/BSIZE));
+    m = min(n - tot, BSIZE - off%BSIZE);
+    memmove(dst, bp->data + off%BSIZE, m);
+    brelse(bp);
+  }
+  return n;
+}
+
+// Read data from inode.  Regular files are read through
+// the page cache, falling back to the blocks if no page
+// can be had.
 // Caller must hold ip->lock.
 int
 readi(struct inode *ip, char *dst, uint off, uint n)
 {
   uint tot, m;
-  struct buf *bp;
+  char *page;
 
   if(ip->type == T_DEV){
     if(ip->major < 0 || ip->major >= NDEV || !devsw[ip->major].read)
@@ -466,48 +812,303 @@ readi(struct inode *ip, char *dst, uint off, uint n)
   if(off + n > ip->size)
     n = ip->size - off;
 
+  if(ip->type != T_FILE || ip->dev == TMPDEV)
+    return readidisk(ip, dst, off, n);
+
   for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
+    m = min(n - tot, PGSIZE - off%PGSIZE);
+    if((page = pcacheget(ip, PGROUNDDOWN(off))) == 0){
+      readidisk(ip, dst, off, m);
+      continue;
+    }
+    memmove(dst, page + off%PGSIZE, m);
+    kfree(page);
+  }
+  return n;
+}
+
+// Work function for ireadahead(): start reading the blocks
+// of r->ip that hold [r->off, r->off+r->n) into the buffer
+// cache, without waiting for the disk.
+static void
+readahead(void *arg)
+{
+  struct rawork *r = arg;
+  struct inode *ip;
+  uint bn, end, off, n;
+
+  ip = r->ip;
+  off = r->off;
+  n = r->n;
+  acquire(&ratab.lock);
+  r->ip = 0;
+  release(&ratab.lock);
+
+  ilock(ip);
+  if(off < ip->dsize){
+    if(off + n > ip->dsize || off + n < off)
+      n = ip->dsize - off;
+    end = (off + n + BSIZE - 1) / BSIZE;
+    for(bn = off/BSIZE; bn < end; bn++)
+      bprefetch(ip->dev, bmap(ip, bn));
+  }
+  iunlock(ip);
+  begin_op();
+  iput(ip);
+  end_op();
+}
+
+// Read the blocks of ip that hold [off, off+n) into the
+// buffer cache in the background: a kworker looks up the
+// blocks and starts the disk.  Read-ahead is only a hint,
+// so this does nothing if NRAWORK requests are outstanding.
+// Caller must hold ip->lock.
+void
+ireadahead(struct inode *ip, uint off, uint n)
+{
+  struct rawork *r;
+
+  if(ip->type == T_DEV || ip->dev == TMPDEV || off >= ip->dsize)
+    return;
+  acquire(&ratab.lock);
+  for(r = ratab.req; r < &ratab.req[NRAWORK]; r++)
+    if(r->ip == 0)
+      break;
+  if(r == &ratab.req[NRAWORK]){
+    release(&ratab.lock);
+    return;
+  }
+  r->ip = idup(ip);
+  r->off = off;
+  r->n = n;
+  release(&ratab.lock);
+  initwork(&r->work, readahead, r);
+  queuework(&r->work);
+}
+
+// PAGEBREAK!
+// Write n bytes at offset off of ip to its disk blocks,
+// growing the file on the disk (ip->dsize) if they go past
+// its end there, which off must not.  Used by writei(), and
+// by iflush() to write back dirty pages, which lie above
+// ip->dsize while ip->size is larger.
+// Caller must hold ip->lock and be in a transaction.
+static void
+writeblocks(struct inode *ip, char *src, uint off, uint n)
+{
+  uint tot, m, newbn;
+  struct buf *bp;
+
+  // Allocate the blocks that the write appends together,
+  // so that the file stays contiguous on disk.  Blocks that
+  // the write fills are new, so they need not be zeroed and
+  // may be written directly, without going through the log:
+  // nothing refers to them until the transaction commits.
+  // Blocks whose freeing hasn't committed yet are the
+  // exception; balloc_n() puts those in the buffer cache,
+  // so idirect() leaves them to the log.
+  newbn = (ip->dsize + BSIZE - 1) / BSIZE;
+  if(off + n > ip->dsize){
+    m = (off + n) / BSIZE;
+    if(m < newbn)
+      m = newbn;
+    bmaprun(ip, newbn, m, 0);
+    bmaprun(ip, m, (off + n + BSIZE - 1) / BSIZE, 1);
+  }
+
+  for(tot=0; tot<n; tot+=m, off+=m, src+=m){
+    if(off/BSIZE >= newbn && (m = idirect(ip, src, off, n - tot, 1)) > 0)
+      continue;
     bp = bread(ip->dev, bmap(ip, off/BSIZE));
     m = min(n - tot, BSIZE - off%BSIZE);
-    memmove(dst, bp->data + off%BSIZE, m);
+    memmove(bp->data + off%BSIZE, src, m);
+    log_write(bp);
     brelse(bp);
   }
-  return n;
+
+  if(n > 0 && off > ip->dsize){
+    ip->dsize = off;
+    if(off > ip->size)
+      ip->size = off;
+    iupdate(ip);
+  }
 }
 
-// PAGEBREAK!
 // Write data to inode.
-// Caller must hold ip->lock.
+// Caller must hold ip->lock, and ip must have no delayed
+// writes (ip->size == ip->dsize); see iflush().
 int
 writei(struct inode *ip, char *src, uint off, uint n)
 {
-  uint tot, m;
-  struct buf *bp;
-
   if(ip->type == T_DEV){
     if(ip->major < 0 || ip->major >= NDEV || !devsw[ip->major].write)
       return -1;
     return devsw[ip->major].write(ip, src, n);
   }
 
+  if(ip->size != ip->dsize)
+    panic("writei: delayed");
+  if(off > ip->size || off + n < off)
+    return -1;
+  if(off + n > MAXFILE*BSIZE)
+    return -1;
+
+  pcachewrite(ip, src, off, n);
+  if(ip->dev == TMPDEV)
+    return tmpwrite(ip, src, off, n);
+  writeblocks(ip, src, off, n);
+  return n;
+}
+
+// Take ip off the delayed list.
+static void
+idelist(struct inode *ip)
+{
+  struct inode **pp;
+
+  acquire(&icache.lock);
+  for(pp = &icache.delayed; *pp != ip; pp = &(*pp)->dnext)
+    ;
+  *pp = ip->dnext;
+  icache.ndelayed--;
+  release(&icache.lock);
+}
+
+// Write data to inode without writing it to the disk: copy
+// it into dirty pages of the page cache, to be written back
+// by iflush().  Returns the number of bytes written, which
+// is less than n if the page cache can't take more.
+// Caller must hold ip->lock, but needn't be in a transaction.
+int
+writeidelay(struct inode *ip, char *src, uint off, uint n)
+{
+  uint tot, m;
+  char *page;
+
+  if(ip->type != T_FILE)
+    return -1;
   if(off > ip->size || off + n < off)
     return -1;
   if(off + n > MAXFILE*BSIZE)
     return -1;
 
   for(tot=0; tot<n; tot+=m, off+=m, src+=m){
-    bp = bread(ip->dev, bmap(ip, off/BSIZE));
-    m = min(n - tot, BSIZE - off%BSIZE);
-    memmove(bp->data + off%BSIZE, src, m);
-    log_write(bp);
-    brelse(bp);
+    if((page = pcachedirty(ip, PGROUNDDOWN(off))) == 0)
+      break;
+    m = min(n - tot, PGSIZE - off%PGSIZE);
+    memmove(page + off%PGSIZE, src, m);
+    kfree(page);
   }
-
-  if(n > 0 && off > ip->size){
+  if(tot > 0 && !ip->delayed){
+    ip->delayed = 1;
+    acquire(&icache.lock);
+    ip->ref++;
+    ip->dnext = icache.delayed;
+    icache.delayed = ip;
+    icache.ndelayed++;
+    release(&icache.lock);
+  }
+  if(off > ip->size)
     ip->size = off;
-    iupdate(ip);
+  if(pcachendirty() >= NPCACHE/4)
+    queuework(&flushwork);
+  return tot;
+}
+
+// Write the delayed writes of ip back to the disk, in
+// transactions of up to logwritemax() bytes.  The dirty pages
+// are written in order of offset, so the file grows on disk
+// as it would have with writei(), and the blocks a run of
+// pages appends are allocated together.
+// Caller must hold a reference to ip, but not ip->lock,
+// and must not be in a transaction.
+void
+iflush(struct inode *ip)
+{
+  char *page;
+  uint off, size, n;
+  int max, done, more, put;
+
+  max = logwritemax();
+  off = 0;
+  do {
+    begin_write(max);
+    ilock(ip);
+    if(ip->nlink == 0){
+      // Nobody can open the file anymore; forget the data.
+      pcacheinval(ip);
+      ip->size = ip->dsize;
+    }
+    size = ip->size;
+    for(done = 0; ; done += PGSIZE){
+      if(done + PGSIZE > max){
+        more = 1;
+        break;
+      }
+      // Pages before off may have been written to while
+      // ip was unlocked between transactions.
+      if((page = pcacheclean(ip, &off)) == 0 && off != 0){
+        off = 0;
+        page = pcacheclean(ip, &off);
+      }
+      if(page == 0){
+        more = 0;
+        break;
+      }
+      n = size - off < PGSIZE ? size - off : PGSIZE;
+      if(off > ip->dsize)
+        panic("iflush: hole");
+      writeblocks(ip, page, off, n);
+      kfree(page);
+      off += PGSIZE;
+    }
+    put = 0;
+    if(!more && ip->delayed){
+      ip->delayed = 0;
+      idelist(ip);
+      put = 1;
+    }
+    iunlock(ip);
+    if(put)
+      iput(ip);
+    end_op();
+  } while(more);
+}
+
+// Write back the delayed writes of every inode that had
+// some when called.
+void
+iflushall(void)
+{
+  struct inode *ip;
+  int n;
+
+  acquire(&icache.lock);
+  n = icache.ndelayed;
+  release(&icache.lock);
+  for(; n > 0; n--){
+    acquire(&icache.lock);
+    if((ip = icache.delayed) == 0){
+      release(&icache.lock);
+      break;
+    }
+    ip->ref++;
+    release(&icache.lock);
+    iflush(ip);
+    begin_op();
+    iput(ip);
+    end_op();
   }
-  return n;
+}
+
+// Work function that writes delayed writes back every
+// FLUSHTICKS, or sooner when writeidelay() finds the dirty
+// pages starting to fill the page cache.
+static void
+flush(void *arg)
+{
+  iflushall();
+  workafter(&flushwork, FLUSHTICKS);
 }
 
 //PAGEBREAK!
@@ -519,31 +1120,151 @@ namecmp(const char *s, const char *t)
   return strncmp(s, t, DIRSIZ);
 }
 
+static uint
+dirhash(char *name)
+{
+  uint h;
+  int i;
+
+  h = 0;
+  for(i = 0; i < DIRSIZ && name[i]; i++)
+    h = h * 31 + (uchar)name[i];
+  return h;
+}
+
+// Look for name among the dirents of dp at [off, end).
+// Returns the offset of its dirent, or -1.  If *freeoff is
+// -1, sets it to the offset of the first free dirent seen.
+// Sets *empty if a never-used dirent was seen.
+static int
+dirscan(struct inode *dp, char *name, uint off, uint end,
+        int *freeoff, int *empty)
+{
+  struct buf *bp;
+  struct dirent *de;
+  char *data;
+  uint m, base;
+
+  while(off < end){
+    // The dirents in the block, or tmpfs page, holding off.
+    if(dp->dev == TMPDEV){
+      bp = 0;
+      data = tmppage(dp, off);
+      base = PGROUNDDOWN(off);
+      m = min(end, base + PGSIZE);
+    } else {
+      bp = bread(dp->dev, bmap(dp, off/BSIZE));
+      data = (char*)bp->data;
+      base = off - off%BSIZE;
+      m = min(end, base + BSIZE);
+    }
+    for(; off < m; off += sizeof(*de)){
+      de = (struct dirent*)(data + off - base);
+      if(de->inum == 0){
+        if(*freeoff < 0)
+          *freeoff = off;
+        if(de->name[0] == 0)
+          *empty = 1;
+      } else if(namecmp(name, de->name) == 0){
+        if(bp)
+          brelse(bp);
+        return off;
+      }
+    }
+    if(bp)
+      brelse(bp);
+  }
+  return -1;
+}
+
+// Look for name in directory dp, reading its blocks.
+// Returns the offset of its dirent, or -1, and sets
+// *freeoff to the offset of a free dirent where name
+// could be added, or -1 if name would go at the end.
+static int
+dirfind(struct inode *dp, char *name, int *freeoff)
+{
+  uint i, b;
+  int off, empty;
+
+  *freeoff = -1;
+  empty = 0;
+  if((dp->flags & DIR_HASHED) == 0)
+    return dirscan(dp, name, 0, dp->size, freeoff, &empty);
+
+  for(i = 0; i < NDIRHASH; i++){
+    b = (dirhash(name) + i) % NDIRHASH;
+    off = dirscan(dp, name, b*BSIZE, (b+1)*BSIZE, freeoff, &empty);
+    if(off >= 0 || empty)
+      return off;
+  }
+  return dirscan(dp, name, NDIRHASH*BSIZE, dp->size, freeoff, &empty);
+}
+
+// Turn plain directory dp, which is full, into a hashed one.
+static void
+dirhashify(struct inode *dp)
+{
+  static char zero[BSIZE];
+  struct dirent *de;
+  char *old;
+  uint n, off;
+  int freeoff;
+
+  if((old = kalloc()) == 0)
+    panic("dirhashify: kalloc");
+  n = dp->size;
+  if(readi(dp, old, 0, n) != n)
+    panic("dirhashify: readi");
+  for(off = 0; off < NDIRHASH*BSIZE; off += BSIZE)
+    if(writei(dp, zero, off, BSIZE) != BSIZE)
+      panic("dirhashify: writei");
+  dp->flags |= DIR_HASHED;
+  iupdate(dp);
+  dcacheinval(dp);
+
+  for(de = (struct dirent*)old; de < (struct dirent*)(old + n); de++){
+    if(de->inum == 0)
+      continue;
+    if(dirfind(dp, de->name, &freeoff) >= 0 || freeoff < 0)
+      panic("dirhashify");
+    if(writei(dp, (char*)de, freeoff, sizeof(*de)) != sizeof(*de))
+      panic("dirhashify: writei");
+  }
+  kfree(old);
+}
+
 // Look for a directory entry in a directory.
 // If found, set *poff to byte offset of entry.
 struct inode*
 dirlookup(struct inode *dp, char *name, uint *poff)
 {
-  uint off, inum;
+  uint inum, off;
+  int freeoff, found;
   struct dirent de;
 
   if(dp->type != T_DIR)
     panic("dirlookup not DIR");
 
-  for(off = 0; off < dp->size; off += sizeof(de)){
-    if(readi(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
+  if(dcachelookup(dp, name, &inum, &off)){
+    if(inum == 0)
+      return 0;
+    if(poff)
+      *poff = off;
+    return iget(dp->dev, inum);
+  }
+
+  if((found = dirfind(dp, name, &freeoff)) >= 0){
+    // entry matches path element
+    if(readi(dp, (char*)&de, found, sizeof(de)) != sizeof(de))
       panic("dirlookup read");
-    if(de.inum == 0)
-      continue;
-    if(namecmp(name, de.name) == 0){
-      // entry matches path element
-      if(poff)
-        *poff = off;
-      inum = de.inum;
-      return iget(dp->dev, inum);
-    }
+    if(poff)
+      *poff = found;
+    dcacheenter(dp, name, de.inum, found);
+    return iget(dp->dev, de.inum);
   }
 
+  dcacheenter(dp, name, 0, 0);
   return 0;
 }
 
@@ -561,25 +1282,202 @@ dirlink(struct inode *dp, char *name, uint inum)
     return -1;
   }
 
-  // Look for an empty dirent.
-  for(off = 0; off < dp->size; off += sizeof(de)){
-    if(readi(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
-      panic("dirlink read");
-    if(de.inum == 0)
-      break;
+  // Look for an empty dirent, hashing a plain
+  // directory that has grown big.
+  dirfind(dp, name, &off);
+  if(off < 0 && (dp->flags & DIR_HASHED) == 0 &&
+     dp->size >= DIRLINEAR*BSIZE && dp->size <= PGSIZE){
+    dirhashify(dp);
+    dirfind(dp, name, &off);
   }
+  if(off < 0)
+    off = dp->size;
 
+  memset(&de, 0, sizeof(de));
   strncpy(de.name, name, DIRSIZ);
   de.inum = inum;
   if(writei(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
     panic("dirlink");
+  dcacheenter(dp, name, inum, off);
 
   return 0;
 }
 
+// Has some name in hashed directory dp passed over bucket b
+// on its way to a later bucket, or to the dirents after the
+// buckets?  No name passes over a bucket with a never-used
+// dirent, so the search stops at one.  buf is a page to read
+// the buckets into.
+static int
+dirpassed(struct inode *dp, uint b, char *buf)
+{
+  struct dirent *de;
+  uint i, j, h, off, n;
+  int empty;
+
+  for(i = 0; i < NDIRHASH; i++){
+    j = (b + i) % NDIRHASH;
+    if(readi(dp, buf, j*BSIZE, BSIZE) != BSIZE)
+      panic("dirpassed: readi");
+    empty = 0;
+    for(de = (struct dirent*)buf; de < (struct dirent*)(buf + BSIZE); de++){
+      if(de->inum == 0){
+        if(de->name[0] == 0)
+          empty = 1;
+        continue;
+      }
+      h = dirhash(de->name) % NDIRHASH;
+      if((b + NDIRHASH - h) % NDIRHASH < (j + NDIRHASH - h) % NDIRHASH)
+        return 1;
+    }
+    if(empty)
+      return 0;
+  }
+
+  // All buckets are full: the names after them passed over b.
+  for(off = NDIRHASH*BSIZE; off < dp->size; off += n){
+    n = min(dp->size - off, BSIZE);
+    if(readi(dp, buf, off, n) != n)
+      panic("dirpassed: readi");
+    for(de = (struct dirent*)buf; de < (struct dirent*)(buf + n); de++)
+      if(de->inum != 0)
+        return 1;
+  }
+  return 0;
+}
+
+// Turn the unlinked names in bucket b of hashed directory dp
+// back into never-used dirents, unless some name has passed
+// over the bucket and a search for it must go on past b.
+static void
+dirreclaim(struct inode *dp, uint b)
+{
+  struct dirent *de;
+  char *buf;
+  int n;
+
+  if((buf = kalloc()) == 0)
+    return;
+  if(!dirpassed(dp, b, buf)){
+    if(readi(dp, buf, b*BSIZE, BSIZE) != BSIZE)
+      panic("dirreclaim: readi");
+    n = 0;
+    for(de = (struct dirent*)buf; de < (struct dirent*)(buf + BSIZE); de++){
+      if(de->inum == 0 && de->name[0] != 0){
+        memset(de, 0, sizeof(*de));
+        n++;
+      }
+    }
+    if(n > 0 && writei(dp, buf, b*BSIZE, BSIZE) != BSIZE)
+      panic("dirreclaim: writei");
+  }
+  kfree(buf);
+}
+
+// Remove the directory entry for name, at byte offset off,
+// from dp.  A hashed directory keeps the name in the dirent
+// if a search may still have to go past its bucket.
+void
+dirunlink(struct inode *dp, char *name, uint off)
+{
+  struct dirent de;
+
+  memset(&de, 0, sizeof(de));
+  if(dp->flags & DIR_HASHED)
+    strncpy(de.name, name, DIRSIZ);
+  if(writei(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
+    panic("dirunlink");
+  dcacheremove(dp, name);
+  if((dp->flags & DIR_HASHED) && off < NDIRHASH*BSIZE)
+    dirreclaim(dp, off/BSIZE);
+}
+
 //PAGEBREAK!
 // Paths
 
+// The mount table: the root directory of file system dev
+// takes the place of the directory ip in path names.  The
+// table holds a reference to ip.  Entries are only added, by
+// mount() at boot, so namex() reads the table without a lock.
+struct mount {
+  struct inode *ip;   // 0 if this slot is free
+  uint dev;
+} mtab[NMOUNT];
+
+// Mount file system dev, whose root i-node is ROOTINO,
+// on the directory path.
+int
+mount(char *path, uint dev)
+{
+  struct mount *m;
+  struct inode *ip;
+
+  for(m = mtab; m < &mtab[NMOUNT]; m++)
+    if(m->ip == 0)
+      break;
+  if(m == &mtab[NMOUNT])
+    return -1;
+  begin_op();
+  if((ip = namei(path)) == 0){
+    end_op();
+    return -1;
+  }
+  ilock(ip);
+  if(ip->type != T_DIR){
+    iunlockput(ip);
+    end_op();
+    return -1;
+  }
+  iunlock(ip);
+  end_op();
+  m->dev = dev;
+  m->ip = ip;
+  return 0;
+}
+
+// Is ip a mount point?
+int
+ismount(struct inode *ip)
+{
+  struct mount *m;
+
+  for(m = mtab; m < &mtab[NMOUNT]; m++)
+    if(m->ip == ip)
+      return 1;
+  return 0;
+}
+
+// If ip is a mount point, return the root of the file system
+// mounted on it instead, dropping the reference to ip.
+static struct inode*
+mountroot(struct inode *ip)
+{
+  struct mount *m;
+
+  for(m = mtab; m < &mtab[NMOUNT]; m++){
+    if(m->ip && m->ip == ip){
+      iput(ip);
+      return iget(m->dev, ROOTINO);
+    }
+  }
+  return ip;
+}
+
+// If ip is the root of a mounted file system, return
+// the directory it is mounted on, or else 0.
+static struct inode*
+mountpoint(struct inode *ip)
+{
+  struct mount *m;
+
+  if(ip->inum != ROOTINO)
+    return 0;
+  for(m = mtab; m < &mtab[NMOUNT]; m++)
+    if(m->ip && m->dev == ip->dev)
+      return m->ip;
+  return 0;
+}
+
 // Copy the next path element from path into name.
 // Return a pointer to the element following the copied one.
 // The returned path has no leading slashes,
@@ -620,11 +1518,13 @@ skipelem(char *path, char *name)
 // Look up and return the inode for a path name.
 // If parent != 0, return the inode for the parent and copy the final
 // path element into name, which must have room for DIRSIZ bytes.
+// Crosses into mounted file systems at their mount points, and
+// back out of them at "..".
 // Must be called inside a transaction since it calls iput().
 static struct inode*
 namex(char *path, int nameiparent, char *name)
 {
-  struct inode *ip, *next;
+  struct inode *ip, *next, *up;
 
   if(*path == '/')
     ip = iget(ROOTDEV, ROOTINO);
@@ -642,12 +1542,18 @@ namex(char *path, int nameiparent, char *name)
       iunlock(ip);
       return ip;
     }
+    if(namecmp(name, "..") == 0 && (up = mountpoint(ip)) != 0){
+      // ".." of a mounted root is the parent of its mount point.
+      iunlockput(ip);
+      ip = idup(up);
+      ilock(ip);
+    }
     if((next = dirlookup(ip, name, 0)) == 0){
       iunlockput(ip);
       return 0;
     }
     iunlockput(ip);
-    ip = next;
+    ip = mountroot(next);
   }
   if(nameiparent){
     iput(ip);
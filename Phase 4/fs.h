@@ -21,9 +21,10 @@ struct superblock {
   uint bmapstart;    // Block number of first free map block
 };
 
-#define NDIRECT 12
+#define NDIRECT 10
 #define NINDIRECT (BSIZE / sizeof(uint))
-#define MAXFILE (NDIRECT + NINDIRECT)
+#define NDINDIRECT (NINDIRECT * NINDIRECT)
+#define MAXFILE (NDIRECT + NINDIRECT + NDINDIRECT)
 
 // On-disk inode structure
 struct dinode {
@@ -32,7 +33,8 @@ struct dinode {
   short minor;          // Minor device number (T_DEV only)
   short nlink;          // Number of links to inode in file system
   uint size;            // Size of file (bytes)
-  uint addrs[NDIRECT+1];   // Data block addresses
+  uint flags;           // DIR_HASHED
+  uint addrs[NDIRECT+2];   // Data block addresses
 };
 
 // Inodes per block.
@@ -55,3 +57,19 @@ struct dirent {
   char name[DIRSIZ];
 };
 
+// Dirents per block
+#define DPB           (BSIZE / sizeof(struct dirent))
+
+// A directory is either a plain sequence of dirents, or, if
+// DIR_HASHED is set in the flags field of its inode, hashed:
+// its first NDIRHASH blocks are buckets, and a name goes in
+// bucket dirhash(name) % NDIRHASH, or if that is full in the
+// next bucket that has room.  When all buckets are full, names
+// go in a plain sequence of dirents after them.  An unlinked
+// name in a bucket keeps its name with inum 0, so that only
+// a bucket with a never-used dirent ends the search, until
+// no other name has passed over the bucket (see dirreclaim()).
+#define DIR_HASHED    1
+#define NDIRHASH      16
+#define DIRLINEAR     2   // plain directories are hashed past this many blocks
+
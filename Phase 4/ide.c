@@ -1,4 +1,5 @@
-// Simple PIO-based (non-DMA) IDE driver code.
+// Simple IDE driver code.  Transfers use PCI bus-master DMA
+// if the IDE controller supports it, and PIO otherwise.
 
 #include "types.h"
 #include "defs.h"
@@ -12,6 +13,7 @@
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
+#include "pci.h"
 
 #define SECTOR_SIZE   512
 #define IDE_BSY       0x80
@@ -23,16 +25,53 @@
 #define IDE_CMD_WRITE 0x30
 #define IDE_CMD_RDMUL 0xc4
 #define IDE_CMD_WRMUL 0xc5
+#define IDE_CMD_SETMUL 0xc6
+#define IDE_CMD_RDDMA 0xc8
+#define IDE_CMD_WRDMA 0xca
 
-// idequeue points to the buf now being read/written to the disk.
-// idequeue->qnext points to the next buf to be processed.
+#define MAXMULT       16  // sectors per RDMUL/WRMUL interrupt
+#define MAXDMA        64  // sectors per DMA request
+
+// Bus-master IDE registers, from the controller's BAR4,
+// primary channel.
+#define BM_CMD        0   // command
+#define BM_STATUS     2   // status
+#define BM_PRDT       4   // physical address of the PRD table
+#define BM_CMD_START  0x01
+#define BM_CMD_READ   0x08  // transfer from disk to memory
+#define BM_ST_ERR     0x02
+#define BM_ST_INTR    0x04
+
+// Physical region descriptor: one piece of a DMA transfer.
+// A region may not cross a 64KB boundary.
+struct prd {
+  uint addr;
+  ushort len;
+  ushort flags;
+};
+#define PRD_EOT       0x8000  // last descriptor of the table
+
+// idequeue points to the first buf now being read/written to
+// the disk.  The active request covers the first idebusy bufs
+// of the queue, which are consecutive blocks, transferred by a
+// single multi-sector command.  The rest of the queue waits in
+// elevator (C-SCAN) order: ascending block numbers from idepos,
+// the block just past the active request, then wrapping around
+// to the lowest.
 // You must hold idelock while manipulating queue.
 
 static struct spinlock idelock;
 static struct buf *idequeue;
+static int idebusy;
+static uint idepos;
 
 static int havedisk1;
 static void idestart(struct buf*);
+static void dmainit(void);
+
+static int havevirtio;    // disk 1 is a virtio device, see virtio.c
+static ushort idebm;      // bus-master I/O base, 0 if no DMA
+static struct prd *prdt;  // PRD table, one page
 
 // Wait for IDE disk to become ready.
 static int
@@ -47,6 +86,18 @@ idewait(int checkerr)
   return 0;
 }
 
+// Let RDMUL/WRMUL on disk dev transfer MAXMULT sectors
+// per interrupt.
+static void
+idesetmul(int dev)
+{
+  outb(0x3f6, 2);  // no interrupt for this command
+  outb(0x1f6, 0xe0 | (dev<<4));
+  outb(0x1f2, MAXMULT);
+  outb(0x1f7, IDE_CMD_SETMUL);
+  idewait(0);
+}
+
 void
 ideinit(void)
 {
@@ -54,6 +105,7 @@ ideinit(void)
 
   initlock(&idelock, "ide");
   ioapicenable(IRQ_IDE, ncpu - 1);
+  havevirtio = virtioinit() == 0;
   idewait(0);
 
   // Check if disk 1 is present
@@ -65,35 +117,109 @@ ideinit(void)
     }
   }
 
+  idesetmul(0);
+  if(havedisk1)
+    idesetmul(1);
+
   // Switch back to disk 0.
   outb(0x1f6, 0xe0 | (0<<4));
+
+  dmainit();
+}
+
+// Use bus-master DMA if there is a PCI IDE controller that
+// supports it (prog if bit 7) and a page for the PRD table.
+static void
+dmainit(void)
+{
+  struct pcidev d;
+
+  if(pcifind(PCI_ANY, PCI_ANY, PCI_CLASS_STORAGE, PCI_SUBCLASS_IDE, &d) < 0 ||
+     !(d.progif & 0x80) || !(d.bar[4] & PCI_BAR_IO))
+    return;
+  if((prdt = (struct prd*)kalloc()) == 0)
+    return;
+  pcienable(&d);
+  idebm = PCI_BAR_IOADDR(d.bar[4]);
+  cprintf("ide: bus-master DMA at 0x%x\n", idebm);
+}
+
+// Fill the PRD table for the n bufs starting at b and set up
+// the controller for the transfer.  Caller must hold idelock.
+static void
+dmaprep(struct buf *b, int n, int write)
+{
+  struct prd *p;
+  uint pa, len, m;
+
+  p = prdt;
+  for(; n > 0; n--, b = b->qnext){
+    pa = V2P(b->data);
+    for(len = BSIZE; len > 0; len -= m, pa += m, p++){
+      m = 0x10000 - (pa & 0xFFFF);  // up to the next 64KB boundary
+      if(m > len)
+        m = len;
+      p->addr = pa;
+      p->len = m;
+      p->flags = 0;
+    }
+  }
+  p[-1].flags = PRD_EOT;
+
+  outl(idebm + BM_PRDT, V2P(prdt));
+  outb(idebm + BM_CMD, write ? 0 : BM_CMD_READ);
+  outb(idebm + BM_STATUS, BM_ST_ERR | BM_ST_INTR);  // clear
 }
 
-// Start the request for b.  Caller must hold idelock.
+// Start the request for b, merged with the bufs queued after
+// it that continue it on disk in the same direction.
+// Caller must hold idelock.
 static void
 idestart(struct buf *b)
 {
+  struct buf *last;
+  int n;
+
   if(b == 0)
     panic("idestart");
-  if(b->blockno >= FSSIZE)
-    panic("incorrect blockno");
   int sector_per_block =  BSIZE/SECTOR_SIZE;
+  if (sector_per_block > MAXMULT) panic("idestart");
+
+  int max = (idebm ? MAXDMA : MAXMULT) / sector_per_block;
+  for(n = 1, last = b; n < max && last->qnext; n++){
+    if(last->qnext->dev != b->dev ||
+       last->qnext->blockno != last->blockno + 1 ||
+       (last->qnext->flags & B_DIRTY) != (b->flags & B_DIRTY))
+      break;
+    last = last->qnext;
+  }
+  if(last->blockno >= FSSIZE)
+    panic("incorrect blockno");
+  idebusy = n;
+  idepos = last->blockno + 1;
+
+  int nsector = n * sector_per_block;
   int sector = b->blockno * sector_per_block;
-  int read_cmd = (sector_per_block == 1) ? IDE_CMD_READ :  IDE_CMD_RDMUL;
-  int write_cmd = (sector_per_block == 1) ? IDE_CMD_WRITE : IDE_CMD_WRMUL;
+  int read_cmd = (nsector == 1) ? IDE_CMD_READ :  IDE_CMD_RDMUL;
+  int write_cmd = (nsector == 1) ? IDE_CMD_WRITE : IDE_CMD_WRMUL;
 
-  if (sector_per_block > 7) panic("idestart");
+  if(idebm)
+    dmaprep(b, n, b->flags & B_DIRTY);
 
   idewait(0);
   outb(0x3f6, 0);  // generate interrupt
-  outb(0x1f2, sector_per_block);  // number of sectors
+  outb(0x1f2, nsector);  // number of sectors
   outb(0x1f3, sector & 0xff);
   outb(0x1f4, (sector >> 8) & 0xff);
   outb(0x1f5, (sector >> 16) & 0xff);
   outb(0x1f6, 0xe0 | ((b->dev&1)<<4) | ((sector>>24)&0x0f));
-  if(b->flags & B_DIRTY){
+  if(idebm){
+    outb(0x1f7, (b->flags & B_DIRTY) ? IDE_CMD_WRDMA : IDE_CMD_RDDMA);
+    outb(idebm + BM_CMD, inb(idebm + BM_CMD) | BM_CMD_START);
+  } else if(b->flags & B_DIRTY){
     outb(0x1f7, write_cmd);
-    outsl(0x1f0, b->data, BSIZE/4);
+    for(; n > 0; n--, b = b->qnext)
+      outsl(0x1f0, b->data, BSIZE/4);
   } else {
     outb(0x1f7, read_cmd);
   }
@@ -103,7 +229,8 @@ idestart(struct buf *b)
 void
 ideintr(void)
 {
-  struct buf *b;
+  struct buf *b, *done;
+  int rd;
 
   // First queued buffer is the active request.
   acquire(&idelock);
@@ -112,33 +239,66 @@ ideintr(void)
     release(&idelock);
     return;
   }
-  idequeue = b->qnext;
 
-  // Read data if needed.
-  if(!(b->flags & B_DIRTY) && idewait(1) >= 0)
-    insl(0x1f0, b->data, BSIZE/4);
+  if(idebm){
+    // Stop the DMA engine; the data is already in memory.
+    outb(idebm + BM_CMD, inb(idebm + BM_CMD) & ~BM_CMD_START);
+    outb(idebm + BM_STATUS, BM_ST_ERR | BM_ST_INTR);
+    idewait(0);  // reading the status acknowledges the interrupt
+    rd = 0;
+  } else {
+    // Read data if needed.
+    rd = !(b->flags & B_DIRTY) && idewait(1) >= 0;
+  }
+
+  done = 0;
+  for(; idebusy > 0; idebusy--){
+    b = idequeue;
+    idequeue = b->qnext;
+    if(rd)
+      insl(0x1f0, b->data, BSIZE/4);
 
-  // Wake process waiting for this buf.
-  b->flags |= B_VALID;
-  b->flags &= ~B_DIRTY;
-  wakeup(b);
+    // Wake process waiting for this buf.
+    b->flags |= B_VALID;
+    b->flags &= ~B_DIRTY;
+    wakeup(b);
+
+    // Nobody is waiting for an asynchronous request.
+    if(b->flags & B_ASYNC){
+      b->qnext = done;
+      done = b;
+    }
+  }
 
   // Start disk on next buf in queue.
   if(idequeue != 0)
     idestart(idequeue);
 
   release(&idelock);
+
+  while((b = done) != 0){
+    done = b->qnext;
+    bdone(b);
+  }
 }
 
 //PAGEBREAK!
-// Sync buf with disk.
+// Queue b to be synced with the disk, and return without
+// waiting: call iderwwait(b) before using b again.
 // If B_DIRTY is set, write buf to disk, clear B_DIRTY, set B_VALID.
 // Else if B_VALID is not set, read buf from disk, set B_VALID.
+// If B_ASYNC is set, nobody will wait; the buffer is released
+// with bdone() when the disk is done with it.
 void
-iderw(struct buf *b)
+iderwstart(struct buf *b)
 {
   struct buf **pp;
+  int i;
 
+  if(b->dev != 0 && havevirtio){
+    virtiorwstart(b);
+    return;
+  }
   if(!holdingsleep(&b->lock))
     panic("iderw: buf not locked");
   if((b->flags & (B_VALID|B_DIRTY)) == B_VALID)
@@ -148,21 +308,49 @@ iderw(struct buf *b)
 
   acquire(&idelock);  //DOC:acquire-lock
 
-  // Append b to idequeue.
-  b->qnext = 0;
-  for(pp=&idequeue; *pp; pp=&(*pp)->qnext)  //DOC:insert-queue
+  // Insert b in elevator order, behind the active request.
+  pp = &idequeue;
+  for(i = 0; i < idebusy; i++)
+    pp = &(*pp)->qnext;
+  for(; *pp && (*pp)->blockno - idepos <= b->blockno - idepos;
+      pp=&(*pp)->qnext)  //DOC:insert-queue
     ;
+  b->qnext = *pp;
   *pp = b;
 
   // Start disk if necessary.
   if(idequeue == b)
     idestart(b);
 
-  // Wait for request to finish.
+  release(&idelock);
+}
+
+// Wait for the request for b started by iderwstart() to finish.
+void
+iderwwait(struct buf *b)
+{
+  if(b->dev != 0 && havevirtio){
+    virtiorwwait(b);
+    return;
+  }
+  acquire(&idelock);
   while((b->flags & (B_VALID|B_DIRTY)) != B_VALID){
     sleep(b, &idelock);
   }
+  release(&idelock);
+}
 
+// Sync buf with disk.
+// If B_DIRTY is set, write buf to disk, clear B_DIRTY, set B_VALID.
+// Else if B_VALID is not set, read buf from disk, set B_VALID.
+// If B_ASYNC is set, return at once; the buffer is released
+// with bdone() when the disk is done with it.
+void
+iderw(struct buf *b)
+{
+  int async = b->flags & B_ASYNC;
 
-  release(&idelock);
+  iderwstart(b);
+  if(!async)
+    iderwwait(b);
 }
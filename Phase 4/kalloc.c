@@ -10,6 +10,7 @@
 #include "spinlock.h"
 
 void freerange(void *vstart, void *vend);
+static int splitsuper(void);
 extern char end[]; // first address after kernel loaded from ELF file
                    // defined by the kernel linker script in kernel.ld
 
@@ -21,6 +22,10 @@ struct {
   struct spinlock lock;
   int use_lock;
   struct run *freelist;
+  uchar ref[PHYSTOP/PGSIZE]; // mappings of each physical page
+  char *superbase;           // NSUPERPAGE 4MB pages start here
+  uchar superref[NSUPERPAGE];
+  uchar supersplit[NSUPERPAGE]; // given to kalloc(), see splitsuper()
 } kmem;
 
 // Initialization happens in two phases.
@@ -36,10 +41,16 @@ kinit1(void *vstart, void *vend)
   freerange(vstart, vend);
 }
 
+// The top NSUPERPAGE*4MB of memory is kept off the free list
+// for kallocsuper(), until kalloc() runs out of other pages.
 void
 kinit2(void *vstart, void *vend)
 {
-  freerange(vstart, vend);
+  kmem.superbase = (char*)(((uint)vend & ~(SUPERPGSIZE-1)) -
+                           NSUPERPAGE*SUPERPGSIZE);
+  if(kmem.superbase < (char*)vstart)
+    panic("kinit2: no room for superpages");
+  freerange(vstart, kmem.superbase);
   kmem.use_lock = 1;
 }
 
@@ -56,6 +67,8 @@ freerange(void *vstart, void *vend)
 // which normally should have been returned by a
 // call to kalloc().  (The exception is when
 // initializing the allocator; see kinit above.)
+// A page shared with kincref() is only put back on
+// the free list when its last reference is dropped.
 void
 kfree(char *v)
 {
@@ -64,6 +77,18 @@ kfree(char *v)
   if((uint)v % PGSIZE || v < end || V2P(v) >= PHYSTOP)
     panic("kfree");
 
+  if(kmem.use_lock)
+    acquire(&kmem.lock);
+  if(kmem.ref[V2P(v)/PGSIZE] > 1){
+    kmem.ref[V2P(v)/PGSIZE]--;
+    if(kmem.use_lock)
+      release(&kmem.lock);
+    return;
+  }
+  kmem.ref[V2P(v)/PGSIZE] = 0;
+  if(kmem.use_lock)
+    release(&kmem.lock);
+
   // Fill with junk to catch dangling refs.
   memset(v, 1, PGSIZE);
 
@@ -79,18 +104,134 @@ kfree(char *v)
 // Allocate one 4096-byte page of physical memory.
 // Returns a pointer that the kernel can use.
 // Returns 0 if the memory cannot be allocated.
+// When memory runs out, first takes back some of the pages
+// the page cache holds that nobody has mapped, and then
+// breaks up a superpage that nobody has allocated.
 char*
 kalloc(void)
 {
   struct run *r;
+  int retry;
+
+  for(retry = 0; ; retry++){
+    if(kmem.use_lock)
+      acquire(&kmem.lock);
+    r = kmem.freelist;
+    if(r){
+      kmem.freelist = r->next;
+      kmem.ref[V2P(r)/PGSIZE] = 1;
+    }
+    if(kmem.use_lock)
+      release(&kmem.lock);
+    if(r || retry == 2 || !kmem.use_lock)
+      return (char*)r;
+    if(pcachereclaim() == 0 && splitsuper() == 0)
+      return 0;
+  }
+}
+
+// Take another reference to the allocated page v,
+// e.g. to map it into a second address space.
+void
+kincref(char *v)
+{
+  if((uint)v % PGSIZE || v < end || V2P(v) >= PHYSTOP)
+    panic("kincref");
 
   if(kmem.use_lock)
     acquire(&kmem.lock);
-  r = kmem.freelist;
-  if(r)
-    kmem.freelist = r->next;
+  if(kmem.ref[V2P(v)/PGSIZE] == 0 || kmem.ref[V2P(v)/PGSIZE] == 0xff)
+    panic("kincref: ref");
+  kmem.ref[V2P(v)/PGSIZE]++;
   if(kmem.use_lock)
     release(&kmem.lock);
-  return (char*)r;
 }
 
+// Return the number of references to the allocated page v.
+int
+krefcnt(char *v)
+{
+  int n;
+
+  if(kmem.use_lock)
+    acquire(&kmem.lock);
+  n = kmem.ref[V2P(v)/PGSIZE];
+  if(kmem.use_lock)
+    release(&kmem.lock);
+  return n;
+}
+
+
+// Allocate one 4MB superpage (4MB aligned, not zeroed).
+// Returns 0 if none is left.
+char*
+kallocsuper(void)
+{
+  int i;
+
+  acquire(&kmem.lock);
+  for(i = 0; i < NSUPERPAGE; i++){
+    if(kmem.superref[i] == 0 && !kmem.supersplit[i]){
+      kmem.superref[i] = 1;
+      release(&kmem.lock);
+      return kmem.superbase + i*SUPERPGSIZE;
+    }
+  }
+  release(&kmem.lock);
+  return 0;
+}
+
+// Put the pages of a superpage that nobody has allocated on
+// the free list, for kalloc() when it has run out of pages.
+// The superpage is not put back together when they are freed.
+// Returns 0 if there is no such superpage.
+static int
+splitsuper(void)
+{
+  char *p;
+  int i;
+
+  acquire(&kmem.lock);
+  for(i = 0; i < NSUPERPAGE; i++)
+    if(kmem.superref[i] == 0 && !kmem.supersplit[i])
+      break;
+  if(i == NSUPERPAGE){
+    release(&kmem.lock);
+    return 0;
+  }
+  kmem.supersplit[i] = 1;
+  release(&kmem.lock);
+  p = kmem.superbase + i*SUPERPGSIZE;
+  freerange(p, p + SUPERPGSIZE);
+  return 1;
+}
+
+static int
+superidx(char *v)
+{
+  int i;
+
+  i = (v - kmem.superbase) / SUPERPGSIZE;
+  if(v < kmem.superbase || (uint)v % SUPERPGSIZE || i >= NSUPERPAGE ||
+     kmem.superref[i] == 0)
+    panic("superpage");
+  return i;
+}
+
+// Take another reference to the superpage v.
+void
+ksuperincref(char *v)
+{
+  acquire(&kmem.lock);
+  kmem.superref[superidx(v)]++;
+  release(&kmem.lock);
+}
+
+// Drop a reference to the superpage v, freeing it with the last.
+void
+kfreesuper(char *v)
+{
+  acquire(&kmem.lock);
+  kmem.superref[superidx(v)]--;
+  release(&kmem.lock);
+}
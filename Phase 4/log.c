@@ -5,20 +5,45 @@
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
+#include "work.h"
 
 // Simple logging that allows concurrent FS system calls.
 //
 // A log transaction contains the updates of multiple FS system
-// calls. The logging system only commits when there are
-// no FS system calls active. Thus there is never
+// calls. The logging system only closes a transaction when there
+// are no FS system calls active in it. Thus there is never
 // any reasoning required about whether a commit might
 // write an uncommitted system call's updates to disk.
 //
 // A system call should call begin_op()/end_op() to mark
-// its start and end. Usually begin_op() just increments
-// the count of in-progress FS system calls and returns.
+// its start and end. begin_op() reserves log space for the
+// MAXOPBLOCKS blocks a typical FS system call may write;
+// begin_opn() reserves space for a given number of blocks,
+// and begin_write() for a write of a given size.
+// Usually begin_op() just increments the count of
+// in-progress FS system calls and returns.
 // But if it thinks the log is close to running out, it
-// sleeps until the last outstanding end_op() commits.
+// sleeps until the transaction has been committed.
+//
+// Transactions are double-buffered: while one transaction is
+// being committed, new system calls join the next one instead
+// of waiting.  Closing a transaction copies its blocks out of
+// the buffer cache, so the commit writes exactly what the
+// transaction changed even if the next one changes the same
+// blocks meanwhile.  Every system call that ends while a commit
+// is in progress is committed in one go with the next commit
+// (group commit).  Commits are made by the log thread, logd,
+// so end_op() returns without waiting for the disk; logforce()
+// waits for the commit.
+//
+// Committing a transaction appends its blocks to the on-disk
+// log and rewrites the header; it does not install them.
+// Committed blocks are installed at their home locations by a
+// checkpoint, which logd makes only when the log is about to
+// fill up or when the oldest committed block has waited
+// CKPTTICKS.
+// A block rewritten by several transactions in between (say, a
+// bitmap block) is installed just once, from its latest copy.
 //
 // The log is a physical re-do log containing disk blocks.
 // The on-disk log format:
@@ -27,7 +52,8 @@
 //   block B
 //   block C
 //   ...
-// Log appends are synchronous.
+// A block # of 0 marks a copy that a later transaction
+// has superseded.  Log appends are synchronous.
 
 // Contents of the header block, used for both the on-disk header block
 // and to keep track in memory of logged block# before commit.
@@ -40,19 +66,44 @@ struct log {
   struct spinlock lock;
   int start;
   int size;
+  int nslot;       // data blocks in the log, from the superblock
   int outstanding; // how many FS sys calls are executing.
-  int committing;  // in commit(), please wait.
+  int reserved;    // blocks reserved by them since outstanding was 0
+  int closing;     // copying out the blocks of a transaction, please wait.
   int dev;
-  struct logheader lh;
+  struct logheader lh;        // the open transaction
+  struct buf *pin[LOGSIZE];   // its blocks in the buffer cache
+
+  // The committed but not yet installed blocks, as in the
+  // on-disk header, with private copies of their contents in
+  // bufs that are not in the buffer cache.  Only the committer
+  // touches these.
+  struct logheader clh;
+  struct buf *cpin[LOGSIZE];
+  struct buf copy[LOGSIZE];
+  uchar copydata[LOGSIZE][BSIZE];
+  uint ckpttime;              // when clh.n became non-zero
+  uint tid;                   // number of transactions closed
+  uint done;                  // number of them committed
+  struct work ckptwork;       // wakes the log thread for a checkpoint
+
+  // Bitmaps of the blocks freed by the open transaction and
+  // by the one being committed.  Until the transaction that
+  // freed a block commits, a crash would leave the block in
+  // its old file, so its new contents must go through the log.
+  uchar freed[2][(FSSIZE+7)/8];
 };
 struct log log;
 
 static void recover_from_log(void);
-static void commit();
+static void logd(void*);
+static void ckptwake(void*);
 
 void
 initlog(int dev)
 {
+  int i;
+
   if (sizeof(struct logheader) >= BSIZE)
     panic("initlog: too big logheader");
 
@@ -61,8 +112,18 @@ initlog(int dev)
   readsb(dev, &sb);
   log.start = sb.logstart;
   log.size = sb.nlog;
+  log.nslot = log.size - 1;
+  if (log.nslot > LOGSIZE)
+    log.nslot = LOGSIZE;
   log.dev = dev;
+  for (i = 0; i < LOGSIZE; i++) {
+    initsleeplock(&log.copy[i].lock, "logcopy");
+    log.copy[i].data = log.copydata[i];
+  }
   recover_from_log();
+  initwork(&log.ckptwork, ckptwake, 0);
+  if (kthread_create(logd, 0, "logd") == 0)
+    panic("initlog: logd");
 }
 
 // Copy committed blocks from log to their home location
@@ -70,14 +131,25 @@ static void
 install_trans(void)
 {
   int tail;
+  struct buf *dbuf[LOGSIZE];
 
+  // Start all the writes before waiting for any, so that the
+  // disk can take them in order of block number.
   for (tail = 0; tail < log.lh.n; tail++) {
+    dbuf[tail] = 0;
+    if (log.lh.block[tail] == 0)  // superseded
+      continue;
     struct buf *lbuf = bread(log.dev, log.start+tail+1); // read log block
-    struct buf *dbuf = bread(log.dev, log.lh.block[tail]); // read dst
-    memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
-    bwrite(dbuf);  // write dst to disk
+    dbuf[tail] = bread(log.dev, log.lh.block[tail]); // read dst
+    memmove(dbuf[tail]->data, lbuf->data, BSIZE);  // copy block to dst
+    bwritestart(dbuf[tail]);  // write dst to disk
     brelse(lbuf);
-    brelse(dbuf);
+  }
+  for (tail = 0; tail < log.lh.n; tail++) {
+    if (dbuf[tail] == 0)
+      continue;
+    bwait(dbuf[tail]);
+    brelse(dbuf[tail]);
   }
 }
 
@@ -95,18 +167,18 @@ read_head(void)
   brelse(buf);
 }
 
-// Write in-memory log header to disk.
+// Write log header lh to disk.
 // This is the true point at which the
-// current transaction commits.
+// transaction commits.
 static void
-write_head(void)
+write_head(struct logheader *lh)
 {
   struct buf *buf = bread(log.dev, log.start);
   struct logheader *hb = (struct logheader *) (buf->data);
   int i;
-  hb->n = log.lh.n;
-  for (i = 0; i < log.lh.n; i++) {
-    hb->block[i] = log.lh.block[i];
+  hb->n = lh->n;
+  for (i = 0; i < lh->n; i++) {
+    hb->block[i] = lh->block[i];
   }
   bwrite(buf);
   brelse(buf);
@@ -118,91 +190,265 @@ recover_from_log(void)
   read_head();
   install_trans(); // if committed, copy from log to disk
   log.lh.n = 0;
-  write_head(); // clear the log
+  write_head(&log.lh); // clear the log
 }
 
-// called at the start of each FS system call.
+// called at the start of each FS system call that
+// writes at most nblocks blocks.
 void
-begin_op(void)
+begin_opn(int nblocks)
 {
+  if(nblocks > log.nslot)
+    panic("begin_op: too many blocks");
+
   acquire(&log.lock);
   while(1){
-    if(log.committing){
+    if(log.closing){
       sleep(&log, &log.lock);
-    } else if(log.lh.n + (log.outstanding+1)*MAXOPBLOCKS > LOGSIZE){
+    } else if(log.lh.n + log.reserved + nblocks > log.nslot){
       // this op might exhaust log space; wait for commit.
       sleep(&log, &log.lock);
     } else {
       log.outstanding += 1;
+      log.reserved += nblocks;
       release(&log.lock);
       break;
     }
   }
 }
 
+// called at the start of each FS system call.
+void
+begin_op(void)
+{
+  begin_opn(MAXOPBLOCKS);
+}
+
+// called at the start of a writei() of n bytes.
+// Reserves the data blocks, one more for a write
+// that isn't block-aligned, 4 indirect blocks (the
+// double-indirect block and up to 3 it points to),
+// the i-node, and 2 bitmap blocks.
+void
+begin_write(int n)
+{
+  begin_opn((n + BSIZE - 1) / BSIZE + 8);
+}
+
+// The largest write that begin_write() can reserve space
+// for, leaving half of the log to other system calls.
+int
+logwritemax(void)
+{
+  return (log.nslot/2 - 8) * BSIZE;
+}
+
 // called at the end of each FS system call.
-// commits if this was the last outstanding operation.
+// if this was the last outstanding operation, wakes
+// the log thread to commit the transaction, unless it
+// is busy committing the last one, in which case it
+// will pick this transaction up when it is done.
 void
 end_op(void)
 {
-  int do_commit = 0;
-
   acquire(&log.lock);
   log.outstanding -= 1;
-  if(log.committing)
-    panic("log.committing");
   if(log.outstanding == 0){
-    do_commit = 1;
-    log.committing = 1;
-  } else {
-    // begin_op() may be waiting for log space,
-    // and decrementing log.outstanding has decreased
-    // the amount of reserved space.
-    wakeup(&log);
+    log.reserved = 0;  // all blocks written are now in lh.n
+    if(log.lh.n > 0)
+      wakeup(&log.lh);
   }
+  // begin_op() may be waiting for log space,
+  // and log.reserved may have dropped.
+  wakeup(&log);
   release(&log.lock);
+}
 
-  if(do_commit){
-    // call commit w/o holding locks, since not allowed
-    // to sleep with locks.
-    commit();
-    acquire(&log.lock);
-    log.committing = 0;
-    wakeup(&log);
-    release(&log.lock);
+// Wait until the system calls that have already ended are
+// committed, e.g. for fsync().  With group commit, end_op()
+// may return while an earlier commit is still running.
+void
+logforce(void)
+{
+  uint tid;
+
+  acquire(&log.lock);
+  // The open transaction will be the next one closed,
+  // by whoever ends its last system call.
+  tid = log.lh.n > 0 ? log.tid + 1 : log.tid;
+  while(log.done < tid)
+    sleep(&log, &log.lock);
+  release(&log.lock);
+}
+
+// Write the copies in log slots [from, to) to the disk
+// blocks given by blockno[], waiting for all of them.
+// Slots with block # 0 are skipped.
+static void
+write_copies(int from, int to, int *blockno)
+{
+  int i;
+
+  for (i = from; i < to; i++) {
+    if (blockno[i] == 0)
+      continue;
+    acquiresleep(&log.copy[i].lock);
+    log.copy[i].dev = log.dev;
+    log.copy[i].blockno = blockno[i];
+    log.copy[i].flags = B_DIRTY;
+    iderwstart(&log.copy[i]);
+  }
+  for (i = from; i < to; i++) {
+    if (blockno[i] == 0)
+      continue;
+    iderwwait(&log.copy[i]);
+    releasesleep(&log.copy[i].lock);
   }
 }
 
-// Copy modified blocks from cache to log.
+// Install the latest copy of every committed block at its
+// home location, then empty the log.
 static void
-write_log(void)
+checkpoint(void)
 {
-  int tail;
+  int i;
 
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *to = bread(log.dev, log.start+tail+1); // log block
-    struct buf *from = bread(log.dev, log.lh.block[tail]); // cache block
-    memmove(to->data, from->data, BSIZE);
-    bwrite(to);  // write the log
-    brelse(from);
-    brelse(to);
+  write_copies(0, log.clh.n, log.clh.block);
+  for (i = 0; i < log.clh.n; i++)
+    bunpin(log.cpin[i]);
+  log.clh.n = 0;
+  write_head(&log.clh);    // Erase the transactions from the log
+}
+
+// Close the open transaction: copy its blocks out of the buffer
+// cache into the next free log slots, and supersede older copies
+// of the same blocks.  No FS system calls are active, and
+// begin_op() waits while log.closing is set.
+// Returns the first slot of the transaction.
+static int
+close_trans(void)
+{
+  int i, j, first;
+
+  first = log.clh.n;
+  for (i = 0; i < log.lh.n; i++) {
+    for (j = 0; j < first; j++) {
+      if (log.clh.block[j] == log.lh.block[i])
+        log.clh.block[j] = 0;
+    }
+    j = first + i;
+    acquiresleep(&log.pin[i]->lock);
+    memmove(log.copy[j].data, log.pin[i]->data, BSIZE);
+    releasesleep(&log.pin[i]->lock);
+    log.cpin[j] = log.pin[i];
+    log.clh.block[j] = log.lh.block[i];
   }
+  log.clh.n = first + log.lh.n;
+  return first;
 }
 
+// Append the copies in slots [first, clh.n) to the log.
+// The log blocks are consecutive, so the disk takes them
+// as a few multi-sector requests.
 static void
-commit()
-{
-  if (log.lh.n > 0) {
-    write_log();     // Write modified blocks from cache to log
-    write_head();    // Write header to disk -- the real commit
-    install_trans(); // Now install writes to home locations
-    log.lh.n = 0;
-    write_head();    // Erase the transaction from the log
+write_log(int first)
+{
+  int i, blockno[LOGSIZE];
+
+  for (i = first; i < log.clh.n; i++)
+    blockno[i] = log.start+i+1;
+  write_copies(first, log.clh.n, blockno);
+}
+
+// Has the oldest committed block waited long enough?
+static int
+ckptdue(void)
+{
+  int due;
+
+  if (log.clh.n == 0)
+    return 0;
+  acquire(&tickslock);
+  due = ticks - log.ckpttime >= CKPTTICKS;
+  release(&tickslock);
+  return due;
+}
+
+// Commit the open transaction.  The caller has set
+// log.closing, with no FS system calls outstanding.
+static void
+commit(void)
+{
+  int first;
+  uint tid;
+
+  // Make room in the log if this transaction doesn't fit.
+  if (log.clh.n + log.lh.n > log.nslot)
+    checkpoint();
+  if (log.clh.n == 0) {
+    acquire(&tickslock);
+    log.ckpttime = ticks;
+    release(&tickslock);
+  }
+
+  first = close_trans();
+  acquire(&log.lock);
+  tid = ++log.tid;
+  memmove(log.freed[1], log.freed[0], sizeof(log.freed[0]));
+  memset(log.freed[0], 0, sizeof(log.freed[0]));
+  log.lh.n = 0;
+  log.closing = 0;
+  wakeup(&log);  // new system calls may join the next transaction
+  release(&log.lock);
+
+  write_log(first);        // Append modified blocks to log
+  write_head(&log.clh);    // Write header to disk -- the real commit
+
+  acquire(&log.lock);
+  log.done = tid;
+  memset(log.freed[1], 0, sizeof(log.freed[1]));
+  wakeup(&log);  // logforce() may be waiting
+  release(&log.lock);
+}
+
+// Work function that wakes the log thread when
+// a checkpoint may be due.
+static void
+ckptwake(void *arg)
+{
+  acquire(&log.lock);
+  wakeup(&log.lh);
+  release(&log.lock);
+}
+
+// The log thread.  Commits the open transaction whenever
+// its last system call ends, and installs the committed
+// blocks when the oldest has waited CKPTTICKS.
+static void
+logd(void *arg)
+{
+  acquire(&log.lock);
+  for(;;){
+    if (log.outstanding == 0 && log.lh.n > 0) {
+      log.closing = 1;
+      release(&log.lock);
+      commit();
+    } else if (ckptdue()) {
+      release(&log.lock);
+      checkpoint();
+    } else {
+      if (log.clh.n > 0)
+        workafter(&log.ckptwork, CKPTTICKS - (ticks - log.ckpttime));
+      sleep(&log.lh, &log.lock);
+      continue;
+    }
+    acquire(&log.lock);
   }
 }
 
 // Caller has modified b->data and is done with the buffer.
-// Record the block number and pin in the cache with B_DIRTY.
+// Record the block number and pin it in the cache with bpin()
+// until a checkpoint has installed it.
 // commit()/write_log() will do the disk write.
 //
 // log_write() replaces bwrite(); a typical use is:
@@ -215,7 +461,7 @@ log_write(struct buf *b)
 {
   int i;
 
-  if (log.lh.n >= LOGSIZE || log.lh.n >= log.size - 1)
+  if (log.lh.n >= log.nslot)
     panic("too big a transaction");
   if (log.outstanding < 1)
     panic("log_write outside of trans");
@@ -226,9 +472,35 @@ log_write(struct buf *b)
       break;
   }
   log.lh.block[i] = b->blockno;
-  if (i == log.lh.n)
+  if (i == log.lh.n) {
     log.lh.n++;
-  b->flags |= B_DIRTY; // prevent eviction
+    log.pin[i] = b;
+    bpin(b);  // prevent eviction
+  }
+  release(&log.lock);
+}
+
+// Record that the current transaction frees block b.
+void
+log_free(uint b)
+{
+  if (b >= FSSIZE)
+    return;
+  acquire(&log.lock);
+  log.freed[0][b/8] |= 1 << (b%8);
   release(&log.lock);
 }
 
+// Was block b freed by a transaction that hasn't committed?
+int
+log_freed(uint b)
+{
+  int r;
+
+  if (b >= FSSIZE)
+    return 1;
+  acquire(&log.lock);
+  r = ((log.freed[0][b/8] | log.freed[1][b/8]) >> (b%8)) & 1;
+  release(&log.lock);
+  return r;
+}
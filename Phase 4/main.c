@@ -29,11 +29,16 @@ main(void)
   pinit();         // process table
   tvinit();        // trap vectors
   binit();         // buffer cache
+  pcacheinit();    // page cache
+  dcacheinit();    // directory name cache
+  shminit();       // shared memory segments
   fileinit();      // file table
+  tmpfsinit();     // RAM file system
   ideinit();       // disk 
   startothers();   // start other processors
   kinit2(P2V(4*1024*1024), P2V(PHYSTOP)); // must come after startothers()
   userinit();      // first user process
+  workinit();      // kworker threads
   mpmain();        // finish this processor's setup
 }
 
@@ -32,6 +32,18 @@ ideintr(void)
   // no-op
 }
 
+// The memory disk finishes every request at once.
+void
+iderwstart(struct buf *b)
+{
+  iderw(b);
+}
+
+void
+iderwwait(struct buf *b)
+{
+}
+
 // Sync buf with disk.
 // If B_DIRTY is set, write buf to disk, clear B_DIRTY, set B_VALID.
 // Else if B_VALID is not set, read buf from disk, set B_VALID.
@@ -57,4 +69,6 @@ iderw(struct buf *b)
   } else
     memmove(b->data, p, BSIZE);
   b->flags |= B_VALID;
+  if(b->flags & B_ASYNC)
+    bdone(b);
 }
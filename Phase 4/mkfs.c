@@ -22,7 +22,7 @@
 
 int nbitmap = FSSIZE/(BSIZE*8) + 1;
 int ninodeblocks = NINODES / IPB + 1;
-int nlog = LOGSIZE;
+int nlog = LOGSIZE + 1;  // header block and LOGSIZE data blocks
 int nmeta;    // Number of meta blocks (boot, sb, nlog, inode, bitmap)
 int nblocks;  // Number of data blocks
 
@@ -31,6 +31,7 @@ struct superblock sb;
 char zeroes[BSIZE];
 uint freeinode = 1;
 uint freeblock;
+struct dirent rootdir[NDIRHASH*DPB];  // hashed root directory
 
 
 void balloc(int);
@@ -40,6 +41,7 @@ void rinode(uint inum, struct dinode *ip);
 void rsect(uint sec, void *buf);
 uint ialloc(ushort type);
 void iappend(uint inum, void *p, int n);
+void rootlink(char *name, uint inum);
 
 // convert to intel byte order
 ushort
@@ -68,10 +70,10 @@ int
 main(int argc, char *argv[])
 {
   int i, cc, fd;
-  uint rootino, inum, off;
-  struct dirent de;
+  uint rootino, inum;
   char buf[BSIZE];
   struct dinode din;
+  struct dirent de;
 
 
   static_assert(sizeof(int) == 4, "Integers must be 4 bytes!");
@@ -117,15 +119,19 @@ main(int argc, char *argv[])
   rootino = ialloc(T_DIR);
   assert(rootino == ROOTINO);
 
-  bzero(&de, sizeof(de));
-  de.inum = xshort(rootino);
-  strcpy(de.name, ".");
-  iappend(rootino, &de, sizeof(de));
+  rootlink(".", rootino);
+  rootlink("..", rootino);
 
-  bzero(&de, sizeof(de));
+  // An empty /tmp, for the kernel to mount its RAM file system on.
+  inum = ialloc(T_DIR);
+  rootlink("tmp", inum);
+  memset(&de, 0, sizeof(de));
+  de.inum = xshort(inum);
+  strcpy(de.name, ".");
+  iappend(inum, &de, sizeof(de));
   de.inum = xshort(rootino);
   strcpy(de.name, "..");
-  iappend(rootino, &de, sizeof(de));
+  iappend(inum, &de, sizeof(de));
 
   for(i = 2; i < argc; i++){
     assert(index(argv[i], '/') == 0);
@@ -144,10 +150,7 @@ main(int argc, char *argv[])
 
     inum = ialloc(T_FILE);
 
-    bzero(&de, sizeof(de));
-    de.inum = xshort(inum);
-    strncpy(de.name, argv[i], DIRSIZ);
-    iappend(rootino, &de, sizeof(de));
+    rootlink(argv[i], inum);
 
     while((cc = read(fd, buf, sizeof(buf))) > 0)
       iappend(inum, buf, cc);
@@ -155,11 +158,11 @@ main(int argc, char *argv[])
     close(fd);
   }
 
-  // fix size of root inode dir
+  // write out the hashed root dir
+  iappend(rootino, rootdir, sizeof(rootdir));
   rinode(rootino, &din);
-  off = xint(din.size);
-  off = ((off/BSIZE) + 1) * BSIZE;
-  din.size = xint(off);
+  din.flags = xint(DIR_HASHED);
+  din.nlink = xshort(xshort(din.nlink) + 1);  // /tmp/..
   winode(rootino, &din);
 
   balloc(freeblock);
@@ -167,6 +170,39 @@ main(int argc, char *argv[])
   exit(0);
 }
 
+// must match dirhash() in fs.c
+uint
+dirhash(char *name)
+{
+  uint h;
+  int i;
+
+  h = 0;
+  for(i = 0; i < DIRSIZ && name[i]; i++)
+    h = h * 31 + (uchar)name[i];
+  return h;
+}
+
+// Add name to the root directory's buckets.
+void
+rootlink(char *name, uint inum)
+{
+  struct dirent *de;
+  uint i, b;
+
+  for(i = 0; i < NDIRHASH; i++){
+    b = (dirhash(name) + i) % NDIRHASH;
+    for(de = &rootdir[b*DPB]; de < &rootdir[(b+1)*DPB]; de++){
+      if(de->inum == 0){
+        de->inum = xshort(inum);
+        strncpy(de->name, name, DIRSIZ);
+        return;
+      }
+    }
+  }
+  assert(0);  // root directory full
+}
+
 void
 wsect(uint sec, void *buf)
 {
@@ -260,7 +296,7 @@ iappend(uint inum, void *xp, int n)
   struct dinode din;
   char buf[BSIZE];
   uint indirect[NINDIRECT];
-  uint x;
+  uint x, ind;
 
   rinode(inum, &din);
   off = xint(din.size);
@@ -273,7 +309,7 @@ iappend(uint inum, void *xp, int n)
         din.addrs[fbn] = xint(freeblock++);
       }
       x = xint(din.addrs[fbn]);
-    } else {
+    } else if(fbn < NDIRECT + NINDIRECT){
       if(xint(din.addrs[NDIRECT]) == 0){
         din.addrs[NDIRECT] = xint(freeblock++);
       }
@@ -283,6 +319,23 @@ iappend(uint inum, void *xp, int n)
         wsect(xint(din.addrs[NDIRECT]), (char*)indirect);
       }
       x = xint(indirect[fbn-NDIRECT]);
+    } else {
+      if(xint(din.addrs[NDIRECT+1]) == 0){
+        din.addrs[NDIRECT+1] = xint(freeblock++);
+      }
+      rsect(xint(din.addrs[NDIRECT+1]), (char*)indirect);
+      ind = (fbn - NDIRECT - NINDIRECT) / NINDIRECT;
+      if(indirect[ind] == 0){
+        indirect[ind] = xint(freeblock++);
+        wsect(xint(din.addrs[NDIRECT+1]), (char*)indirect);
+      }
+      ind = xint(indirect[ind]);
+      rsect(ind, (char*)indirect);
+      if(indirect[(fbn - NDIRECT - NINDIRECT) % NINDIRECT] == 0){
+        indirect[(fbn - NDIRECT - NINDIRECT) % NINDIRECT] = xint(freeblock++);
+        wsect(ind, (char*)indirect);
+      }
+      x = xint(indirect[(fbn - NDIRECT - NINDIRECT) % NINDIRECT]);
     }
     n1 = min(n, (fbn + 1) * BSIZE - off);
     rsect(x, buf);
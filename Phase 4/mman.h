@@ -0,0 +1,12 @@
+// Arguments to mmap().
+// Both the kernel and user programs use this header file.
+
+#define PROT_READ     0x1   // Pages may be read
+#define PROT_WRITE    0x2   // Pages may be written
+
+#define MAP_SHARED    0x01  // Share changes with the file and other processes
+#define MAP_PRIVATE   0x02  // Changes are private to this process
+#define MAP_ANONYMOUS 0x20  // Zero-filled memory, no file
+#define MAP_HUGE      0x40000 // Anonymous memory in 4MB pages
+
+#define MAP_FAILED    ((void*)-1)
@@ -0,0 +1,130 @@
+#include "types.h"
+#include "stat.h"
+#include "fcntl.h"
+#include "user.h"
+#include "mman.h"
+
+#define PGSIZE 4096
+#define FILESZ (2*PGSIZE + 100)
+
+char buf[FILESZ];
+
+void
+fail(char *msg)
+{
+  printf(1, "mmaptest: %s failed\n", msg);
+  exit();
+}
+
+void
+makefile(char *name)
+{
+  int fd, i;
+
+  for(i = 0; i < FILESZ; i++)
+    buf[i] = 'a' + i % 26;
+  unlink(name);
+  if((fd = open(name, O_CREATE|O_RDWR)) < 0)
+    fail("create");
+  if(write(fd, buf, FILESZ) != FILESZ)
+    fail("write");
+  close(fd);
+}
+
+void
+anontest(void)
+{
+  char *p;
+  int i;
+
+  printf(1, "anonymous mappings\n");
+  p = mmap(0, 3*PGSIZE, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+  if(p == MAP_FAILED)
+    fail("mmap private");
+  for(i = 0; i < 3*PGSIZE; i++)
+    if(p[i] != 0)
+      fail("zero fill");
+  p[0] = 'x';
+  if(fork() == 0){
+    p[0] = 'y';
+    exit();
+  }
+  wait();
+  if(p[0] != 'x')
+    fail("private after fork");
+  if(munmap(p, 3*PGSIZE) < 0)
+    fail("munmap private");
+
+  p = mmap(0, PGSIZE, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+  if(p == MAP_FAILED)
+    fail("mmap shared");
+  p[0] = 'x';
+  if(fork() == 0){
+    p[0] = 'y';
+    exit();
+  }
+  wait();
+  if(p[0] != 'y')
+    fail("shared after fork");
+  if(munmap(p, PGSIZE) < 0)
+    fail("munmap shared");
+}
+
+void
+filetest(void)
+{
+  char *p;
+  int fd, i;
+
+  printf(1, "file mappings\n");
+  makefile("mmap.tmp");
+  if((fd = open("mmap.tmp", O_RDWR)) < 0)
+    fail("open");
+
+  p = mmap(0, FILESZ, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
+  if(p == MAP_FAILED)
+    fail("mmap private file");
+  for(i = 0; i < FILESZ; i++)
+    if(p[i] != buf[i])
+      fail("file contents");
+  for(i = FILESZ; i < 3*PGSIZE; i++)
+    if(p[i] != 0)
+      fail("zero past end of file");
+  p[0] = 'Z';
+  if(munmap(p, FILESZ) < 0)
+    fail("munmap private file");
+
+  p = mmap(0, FILESZ, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+  if(p == MAP_FAILED)
+    fail("mmap shared file");
+  if(p[0] != buf[0])
+    fail("private write leaked into file");
+  p[1] = 'Z';
+  p[PGSIZE + 1] = 'Z';
+  // Unmap the middle page first, splitting the mapping.
+  if(munmap(p + PGSIZE, PGSIZE) < 0)
+    fail("munmap middle");
+  if(p[2*PGSIZE] != buf[2*PGSIZE])
+    fail("contents after split");
+  if(munmap(p, PGSIZE) < 0 || munmap(p + 2*PGSIZE, PGSIZE) < 0)
+    fail("munmap shared file");
+  close(fd);
+
+  if((fd = open("mmap.tmp", O_RDONLY)) < 0)
+    fail("reopen");
+  if(read(fd, buf, FILESZ) != FILESZ)
+    fail("read back");
+  close(fd);
+  if(buf[1] != 'Z' || buf[PGSIZE + 1] != 'Z')
+    fail("write back");
+  unlink("mmap.tmp");
+}
+
+int
+main(int argc, char *argv[])
+{
+  anontest();
+  filetest();
+  printf(1, "mmaptest ok\n");
+  exit();
+}
@@ -3,12 +3,27 @@
 #define NCPU          8  // maximum number of CPUs
 #define NOFILE       16  // open files per process
 #define NFILE       100  // open files per system
-#define NINODE       50  // maximum number of active i-nodes
+#define NINODE       50  // minimum number of cached i-nodes
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
+#define TMPDEV       64  // device number of the RAM file system
+#define NTMPINODE   200  // i-nodes in the RAM file system
+#define NMOUNT        4  // mounted file systems
 #define MAXARG       32  // max exec arguments
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
-#define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
-#define FSSIZE       1000  // size of file system in blocks
+#define LOGSIZE      126  // max data blocks in on-disk log
+#define NBUF         (MAXOPBLOCKS*3)  // minimum size of disk block cache
+#define CKPTTICKS    300  // max ticks committed blocks wait to be installed
+#define FLUSHTICKS   300  // max ticks delayed writes wait to be written back
+#define NBUCKET      13  // hash buckets in the disk block cache
+#define NGHOST     1024  // recently evicted blocks remembered by the cache
+#define MAXREADAHEAD 32  // max blocks read ahead of a sequential reader
+#define NRAWORK      16  // read-ahead requests outstanding at once
+#define FSSIZE       20000  // size of file system in blocks
+#define NVMA          8  // demand-paged regions per process
+#define NPCACHE    1024  // pages of file data kept by the page cache
+#define NDCACHE     128  // names kept by the directory name cache
+#define NSHM         16  // shared memory segments per system
+#define SHMPAGES     16  // maximum pages in a shared memory segment
+#define NSUPERPAGE    4  // 4MB pages kept for MAP_HUGE while memory lasts
 
@@ -0,0 +1,359 @@
+// Page cache.
+//
+// The page cache holds page-sized pieces of file contents,
+// keyed by (dev, inum, file offset).  readi() reads regular
+// files through it, and exec() and mmap() map file pages out
+// of it on demand, so processes reading the same file, running
+// the same binary or mapping the same file share the same
+// physical pages, and reading a cached page again needs no
+// block lookups at all.
+//
+// Normally the cache is write-through: writei() writes file
+// data to the disk blocks, through the log, and copies it into
+// the cached pages it overlaps.  Files opened with O_WBACK
+// instead have their writes buffered in dirty pages, which
+// stay cached until iflush() writes them back.  kalloc()
+// reclaims a few clean pages that nobody maps whenever it
+// runs out of memory.
+//
+// New pages take a free slot if there is one, or else replace
+// a clean page that nobody maps, chosen by the clock algorithm
+// using a used bit set on each hit, as in the buffer cache.
+//
+// Interface:
+// * pcacheget() returns the page holding the file contents at
+//   a given offset, reading it from the inode if necessary.
+//   The caller gets its own reference to the page (kincref)
+//   and drops it with kfree().
+// * pcachewrite() copies newly written file data into the
+//   cached pages it overlaps, so readers and mappings see
+//   the change.
+// * pcacheshared() is pcacheget() for a page about to be
+//   mapped MAP_SHARED, which must be the cached page.
+// * pcachedirty() is pcacheget() for a page about to be
+//   written, which then stays cached until pcacheclean().
+// * pcacheclean() hands iflush() the next dirty page of an
+//   inode to write back.
+// * pcacheinval() forgets every cached page of an inode, for
+//   when the file is truncated.
+// * pcachereclaim() frees some of the clean cached pages
+//   nobody has mapped.
+//
+// The cache itself also holds one reference to each page it
+// keeps, so a cached page is only recycled when no process
+// has it mapped anymore.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+
+#define NPHASH 127
+#define NRECLAIM 32  // pages pcachereclaim() frees at a time
+
+struct cpage {
+  uint dev;
+  uint inum;
+  uint off;        // file offset of the first byte of the page
+  char *data;      // 0 if this slot is free
+  int used;        // hit since the clock hand last passed
+  int dirty;       // holds data not yet written to the disk
+  struct cpage *hnext;  // hash chain, or free list
+};
+
+struct {
+  struct spinlock lock;
+  struct cpage page[NPCACHE];
+  struct cpage *hash[NPHASH];
+  struct cpage *free;   // slots holding no page
+  uint hand;            // clock hand, an index into page[]
+  int ndirty;
+} pcache;
+
+void
+pcacheinit(void)
+{
+  struct cpage *p;
+
+  initlock(&pcache.lock, "pcache");
+  for(p = pcache.page; p < &pcache.page[NPCACHE]; p++){
+    p->hnext = pcache.free;
+    pcache.free = p;
+  }
+}
+
+static struct cpage**
+phash(uint dev, uint inum, uint off)
+{
+  return &pcache.hash[(dev*31 + inum*17 + off/PGSIZE) % NPHASH];
+}
+
+// Find the cached page of (dev, inum) at off.
+// Caller holds pcache.lock.
+static struct cpage*
+find(uint dev, uint inum, uint off)
+{
+  struct cpage *p;
+
+  for(p = *phash(dev, inum, off); p; p = p->hnext)
+    if(p->dev == dev && p->inum == inum && p->off == off)
+      return p;
+  return 0;
+}
+
+// Take p out of the cache and put its slot on the free list,
+// returning its page for the caller to kfree().
+// Caller holds pcache.lock.
+static char*
+drop(struct cpage *p)
+{
+  struct cpage **pp;
+  char *data;
+
+  for(pp = phash(p->dev, p->inum, p->off); *pp != p; pp = &(*pp)->hnext)
+    ;
+  *pp = p->hnext;
+  data = p->data;
+  p->data = 0;
+  if(p->dirty){
+    p->dirty = 0;
+    pcache.ndirty--;
+  }
+  p->hnext = pcache.free;
+  pcache.free = p;
+  return data;
+}
+
+// Advance the clock hand to a clean page that nobody has
+// mapped and that hasn't been hit since the hand last passed,
+// and take it out of the cache.  Returns the page for the
+// caller to kfree(), or 0 if there is none.
+// Caller holds pcache.lock.
+static char*
+evict(void)
+{
+  struct cpage *p;
+  int i;
+
+  for(i = 0; i < 2*NPCACHE; i++){
+    p = &pcache.page[pcache.hand];
+    pcache.hand = (pcache.hand + 1) % NPCACHE;
+    if(p->data == 0 || p->dirty || krefcnt(p->data) != 1)
+      continue;
+    if(p->used){
+      p->used = 0;
+      continue;
+    }
+    return drop(p);
+  }
+  return 0;
+}
+
+// Return the page holding the contents of ip at offset off,
+// zero-filled beyond the end of the file.  Only the data
+// below ip->dsize is on the disk; the pages above it are
+// dirty, so they are always found in the cache.
+// Caller must hold ip->lock, which also keeps other
+// processes from inserting the same page concurrently.
+char*
+pcacheget(struct inode *ip, uint off)
+{
+  struct cpage *p, *victim, **h;
+  char *mem, *old;
+  uint n;
+
+  if(!holdingsleep(&ip->lock))
+    panic("pcacheget");
+
+  // Is the page already cached?
+  acquire(&pcache.lock);
+  if((p = find(ip->dev, ip->inum, off)) != 0){
+    p->used = 1;
+    kincref(p->data);
+    release(&pcache.lock);
+    return p->data;
+  }
+  release(&pcache.lock);
+
+  // Not cached; read it from the file.
+  if((mem = kalloc()) == 0)
+    return 0;
+  memset(mem, 0, PGSIZE);
+  if(off < ip->dsize){
+    n = ip->dsize - off;
+    if(n > PGSIZE)
+      n = PGSIZE;
+    if(readidisk(ip, mem, off, n) != n){
+      kfree(mem);
+      return 0;
+    }
+  }
+
+  // Keep it in a free slot, or in place of a clean page that
+  // nobody else has mapped.  If there is no such slot the
+  // caller simply gets an uncached page.
+  acquire(&pcache.lock);
+  old = 0;
+  if(pcache.free == 0)
+    old = evict();
+  if((victim = pcache.free) != 0){
+    pcache.free = victim->hnext;
+    victim->dev = ip->dev;
+    victim->inum = ip->inum;
+    victim->off = off;
+    victim->data = mem;
+    victim->used = 1;
+    h = phash(ip->dev, ip->inum, off);
+    victim->hnext = *h;
+    *h = victim;
+    kincref(mem);
+  }
+  release(&pcache.lock);
+
+  if(old)
+    kfree(old);
+  return mem;
+}
+
+// Like pcacheget(), but for a page that a MAP_SHARED mapping
+// is about to map: return it only if it is the cached page,
+// since read(), write() and other mappings of the file would
+// never see a page outside the cache.  Returns 0 if the page
+// can't be kept cached.  Caller must hold ip->lock.
+char*
+pcacheshared(struct inode *ip, uint off)
+{
+  struct cpage *p;
+  char *mem;
+
+  if((mem = pcacheget(ip, off)) == 0)
+    return 0;
+  acquire(&pcache.lock);
+  if((p = find(ip->dev, ip->inum, off)) == 0 || p->data != mem){
+    release(&pcache.lock);
+    kfree(mem);
+    return 0;
+  }
+  release(&pcache.lock);
+  return mem;
+}
+
+// Like pcacheget(), but for a page that the caller is about
+// to write into: mark it dirty, so that it stays cached until
+// written back.  Returns 0 if the page can't be kept cached.
+// Caller must hold ip->lock.
+char*
+pcachedirty(struct inode *ip, uint off)
+{
+  struct cpage *p;
+  char *mem;
+
+  if((mem = pcacheget(ip, off)) == 0)
+    return 0;
+  acquire(&pcache.lock);
+  if((p = find(ip->dev, ip->inum, off)) == 0 || p->data != mem){
+    release(&pcache.lock);
+    kfree(mem);
+    return 0;
+  }
+  if(!p->dirty){
+    p->dirty = 1;
+    pcache.ndirty++;
+  }
+  release(&pcache.lock);
+  return mem;
+}
+
+// Find the first dirty page of ip at or after *off, below
+// ip->size.  Mark it clean and return it, with a reference
+// for the caller, and its offset in *off; the caller then
+// writes it to the disk.  Returns 0 if there is none.
+// Caller must hold ip->lock, so nobody dirties the page
+// again before it is written.
+char*
+pcacheclean(struct inode *ip, uint *off)
+{
+  struct cpage *p;
+  uint a;
+
+  acquire(&pcache.lock);
+  for(a = PGROUNDDOWN(*off); a < ip->size; a += PGSIZE){
+    if((p = find(ip->dev, ip->inum, a)) == 0 || !p->dirty)
+      continue;
+    p->dirty = 0;
+    pcache.ndirty--;
+    kincref(p->data);
+    release(&pcache.lock);
+    *off = a;
+    return p->data;
+  }
+  release(&pcache.lock);
+  return 0;
+}
+
+// Number of dirty pages in the cache.
+int
+pcachendirty(void)
+{
+  return pcache.ndirty;
+}
+
+// Copy the n bytes at src, just written to ip at offset off,
+// into the cached pages of ip that they overlap.
+// Caller must hold ip->lock.
+void
+pcachewrite(struct inode *ip, char *src, uint off, uint n)
+{
+  struct cpage *p;
+  uint a, lo, hi;
+
+  acquire(&pcache.lock);
+  for(a = PGROUNDDOWN(off); a < off + n; a += PGSIZE){
+    if((p = find(ip->dev, ip->inum, a)) == 0)
+      continue;
+    lo = off > a ? off : a;
+    hi = off + n < a + PGSIZE ? off + n : a + PGSIZE;
+    memmove(p->data + (lo - a), src + (lo - off), hi - lo);
+  }
+  release(&pcache.lock);
+}
+
+// Drop all cached pages of ip, dirty ones included.  Pages
+// that are still mapped by some process stay allocated
+// until unmapped.
+void
+pcacheinval(struct inode *ip)
+{
+  struct cpage *p;
+
+  acquire(&pcache.lock);
+  for(p = pcache.page; p < &pcache.page[NPCACHE]; p++)
+    if(p->data && p->dev == ip->dev && p->inum == ip->inum)
+      kfree(drop(p));
+  release(&pcache.lock);
+}
+
+// Free up to NRECLAIM clean cached pages that no process
+// has mapped, chosen as for replacement, so that most of the
+// cache survives.  Called by kalloc() when it runs out of
+// memory, so the caller must not hold pcache.lock.
+// Returns the number of pages freed.
+int
+pcachereclaim(void)
+{
+  char *data;
+  int n;
+
+  acquire(&pcache.lock);
+  for(n = 0; n < NRECLAIM; n++){
+    if((data = evict()) == 0)
+      break;
+    kfree(data);
+  }
+  release(&pcache.lock);
+  return n;
+}
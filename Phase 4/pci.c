@@ -0,0 +1,76 @@
+// Minimal PCI support: find devices on bus 0, where QEMU
+// and most simple machines put everything, using
+// configuration mechanism #1.
+
+#include "types.h"
+#include "defs.h"
+#include "x86.h"
+#include "pci.h"
+
+#define PCI_CONFIG_ADDR 0xCF8
+#define PCI_CONFIG_DATA 0xCFC
+
+static uint
+confaddr(uint bus, uint dev, uint func, int off)
+{
+  return 0x80000000 | (bus<<16) | (dev<<11) | (func<<8) | (off & 0xFC);
+}
+
+uint
+pciread(struct pcidev *d, int off)
+{
+  outl(PCI_CONFIG_ADDR, confaddr(d->bus, d->dev, d->func, off));
+  return inl(PCI_CONFIG_DATA);
+}
+
+void
+pciwrite(struct pcidev *d, int off, uint v)
+{
+  outl(PCI_CONFIG_ADDR, confaddr(d->bus, d->dev, d->func, off));
+  outl(PCI_CONFIG_DATA, v);
+}
+
+// Find the first device matching vendor, device, class and
+// subclass (each may be PCI_ANY), and fill in *d.
+// Returns 0 on success, -1 if there is no such device.
+int
+pcifind(int vendor, int device, int class, int subclass, struct pcidev *d)
+{
+  uint id, cl, i, nfunc;
+
+  d->bus = 0;
+  for(d->dev = 0; d->dev < 32; d->dev++){
+    nfunc = 1;
+    for(d->func = 0; d->func < nfunc; d->func++){
+      id = pciread(d, PCI_ID);
+      if((id & 0xFFFF) == 0xFFFF)
+        continue;
+      if(d->func == 0 && (pciread(d, PCI_HEADER) & 0x800000))
+        nfunc = 8;  // multi-function device
+      cl = pciread(d, PCI_CLASS);
+      d->vendor = id & 0xFFFF;
+      d->device = id >> 16;
+      d->class = cl >> 24;
+      d->subclass = (cl >> 16) & 0xFF;
+      d->progif = (cl >> 8) & 0xFF;
+      if((vendor != PCI_ANY && d->vendor != vendor) ||
+         (device != PCI_ANY && d->device != device) ||
+         (class != PCI_ANY && d->class != class) ||
+         (subclass != PCI_ANY && d->subclass != subclass))
+        continue;
+      for(i = 0; i < 6; i++)
+        d->bar[i] = pciread(d, PCI_BAR0 + 4*i);
+      d->irq = pciread(d, PCI_INTR) & 0xFF;
+      return 0;
+    }
+  }
+  return -1;
+}
+
+// Let d respond to I/O and memory accesses and do DMA.
+void
+pcienable(struct pcidev *d)
+{
+  pciwrite(d, PCI_COMMAND,
+           pciread(d, PCI_COMMAND) | PCI_CMD_IO | PCI_CMD_MEM | PCI_CMD_MASTER);
+}
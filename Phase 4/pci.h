@@ -0,0 +1,36 @@
+// PCI configuration space.
+
+struct pcidev {
+  uint bus;
+  uint dev;
+  uint func;
+  ushort vendor;
+  ushort device;
+  uchar class;
+  uchar subclass;
+  uchar progif;
+  uchar irq;        // interrupt line assigned by the BIOS
+  uint bar[6];      // base address registers
+};
+
+// Configuration space registers
+#define PCI_ID          0x00    // vendor and device ID
+#define PCI_COMMAND     0x04    // command and status
+#define PCI_CLASS       0x08    // revision, prog if, subclass, class
+#define PCI_HEADER      0x0C    // header type in bits 16-23
+#define PCI_BAR0        0x10    // first of six base address registers
+#define PCI_INTR        0x3C    // interrupt line in bits 0-7
+
+// Command register bits
+#define PCI_CMD_IO      0x1     // respond to I/O space accesses
+#define PCI_CMD_MEM     0x2     // respond to memory space accesses
+#define PCI_CMD_MASTER  0x4     // may act as bus master (DMA)
+
+// Base address register bits
+#define PCI_BAR_IO      0x1     // BAR is in I/O space
+#define PCI_BAR_IOADDR(bar) ((bar) & ~0x3)
+
+#define PCI_ANY         (-1)    // wildcard for pcifind()
+
+#define PCI_CLASS_STORAGE 0x01
+#define PCI_SUBCLASS_IDE  0x01
@@ -35,6 +35,7 @@ extern void forkret(void);
 extern void trapret(void);
 
 static void wakeup1(void *chan);
+static void kthreadstart(void);
 
 void
 pinit(void)
@@ -104,6 +105,7 @@ allocproc(void)
 found:
   p->state = EMBRYO;
   p->pid = nextpid++;
+  p->bound = 0;
 
   release(&ptable.lock);
 
@@ -169,6 +171,49 @@ userinit(void)
   release(&ptable.lock);
 }
 
+// Start a kernel thread: a process with no user memory,
+// only the kernel part of the page table, that runs fn(arg)
+// in the kernel and exits if fn returns.
+// Returns 0 if there is no free process.
+struct proc*
+kthread_create(void (*fn)(void*), void *arg, char *name)
+{
+  struct proc *p;
+
+  if((p = allocproc()) == 0)
+    return 0;
+  if((p->pgdir = setupkvm()) == 0){
+    kfree(p->kstack);
+    p->kstack = 0;
+    p->state = UNUSED;
+    return 0;
+  }
+  p->context->eip = (uint)kthreadstart;
+  p->kfn = fn;
+  p->karg = arg;
+  safestrcpy(p->name, name, sizeof(p->name));
+
+  acquire(&ptable.lock);
+  p->state = RUNNABLE;
+  release(&ptable.lock);
+  return p;
+}
+
+// Exit the current kernel thread.  It has no files or
+// memory to give up; init will reap it.
+void
+kthread_exit(void)
+{
+  struct proc *curproc = myproc();
+
+  acquire(&ptable.lock);
+  curproc->parent = initproc;
+  wakeup1(initproc);
+  curproc->state = ZOMBIE;
+  sched();
+  panic("zombie exit");
+}
+
 // Grow current process's memory by n bytes.
 // Return 0 on success, -1 on failure.
 int
@@ -176,9 +221,14 @@ growproc(int n)
 {
   uint sz;
   struct proc *curproc = myproc();
+  struct vma *v;
 
   sz = curproc->sz;
   if(n > 0){
+    // Don't grow the heap into an mmap() or shmat() region.
+    for(v = curproc->vma; v < &curproc->vma[NVMA]; v++)
+      if((v->flags & (VMA_MMAP|VMA_SHM)) && sz + n > v->start)
+        return -1;
     if((sz = allocuvm(curproc->pgdir, sz, sz + n)) == 0)
       return -1;
   } else if(n < 0){
@@ -186,7 +236,7 @@ growproc(int n)
       return -1;
   }
   curproc->sz = sz;
-  switchuvm(curproc);
+  lcr3(V2P(curproc->pgdir));  // flush the TLB
   return 0;
 }
 
@@ -212,7 +262,25 @@ fork(void)
     np->state = UNUSED;
     return -1;
   }
+  for(i = 0; i < NVMA; i++){
+    if((curproc->vma[i].flags & (VMA_MMAP|VMA_SHM)) &&
+       vmacopy(np->pgdir, curproc->pgdir, &curproc->vma[i]) < 0){
+      freevm(np->pgdir);
+      np->pgdir = 0;
+      kfree(np->kstack);
+      np->kstack = 0;
+      np->state = UNUSED;
+      return -1;
+    }
+  }
   np->sz = curproc->sz;
+  for(i = 0; i < NVMA; i++){
+    np->vma[i] = curproc->vma[i];
+    if(np->vma[i].ip)
+      idup(np->vma[i].ip);
+    if(np->vma[i].shm)
+      shmdup(np->vma[i].shm);
+  }
   np->parent = curproc;
   *np->tf = *curproc->tf;
 
@@ -258,6 +326,9 @@ exit(void)
     }
   }
 
+  // Write back shared mappings and drop their files.
+  freevma(curproc->pgdir, curproc->vma);
+
   begin_op();
   iput(curproc->cwd);
   end_op();
@@ -349,7 +420,7 @@ scheduler(void)
     // Loop over process table looking for process to run.
     acquire(&ptable.lock);
     for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-      if(p->state != RUNNABLE)
+      if(p->state != RUNNABLE || (p->bound && p->bound != c))
         continue;
 
       // Switch to chosen process.  It is the process's job
@@ -360,7 +431,7 @@ scheduler(void)
       p->state = RUNNING;
 
       swtch(&(c->scheduler), p->context);
-      switchkvm();
+      // Leave p's page table loaded, in case p runs next.
 
       // Process is done running for now.
       // It should have changed its p->state before coming back.
@@ -423,11 +494,26 @@ forkret(void)
     first = 0;
     iinit(ROOTDEV);
     initlog(ROOTDEV);
+    if(mount("/tmp", TMPDEV) < 0)
+      cprintf("cannot mount tmpfs on /tmp\n");
   }
 
   // Return to "caller", actually trapret (see allocproc).
 }
 
+// A kernel thread's very first scheduling by scheduler()
+// will swtch here.
+static void
+kthreadstart(void)
+{
+  struct proc *p = myproc();
+
+  // Still holding ptable.lock from scheduler.
+  release(&ptable.lock);
+  p->kfn(p->karg);
+  kthread_exit();
+}
+
 // Atomically release lock and sleep on chan.
 // Reacquires lock when awakened.
 void
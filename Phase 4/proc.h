@@ -8,6 +8,7 @@ struct cpu {
   int ncli;                    // Depth of pushcli nesting.
   int intena;                  // Were interrupts enabled before pushcli?
   struct proc *proc;           // The process running on this cpu or null
+  pde_t *pgdir;                // Page table loaded in %cr3, 0 if kpgdir
 };
 
 extern struct cpu cpus[NCPU];
@@ -32,6 +33,25 @@ struct context {
   uint eip;
 };
 
+// A region of user virtual memory whose pages are
+// filled in on demand by the page fault handler.
+struct vma {
+  uint start;                  // First virtual address (page aligned)
+  uint end;                    // One past the last virtual address
+  int flags;                   // VMA_*
+  struct inode *ip;            // Backing file, or 0 for zero-fill
+  uint off;                    // File offset corresponding to start
+  uint filesz;                 // Bytes backed by the file, rest is zero
+  struct shmseg *shm;          // Attached shared memory segment, or 0
+};
+
+#define VMA_USED   0x1         // Slot is in use
+#define VMA_WRITE  0x2         // Region may be written
+#define VMA_SHARED 0x4         // Writes go to the file / other processes
+#define VMA_MMAP   0x8         // Created by mmap(), may be munmap()ed
+#define VMA_SHM    0x10        // Attached by shmat(), see shm.c
+#define VMA_HUGE   0x20        // Mapped with 4MB pages, never faults
+
 enum procstate { UNUSED, EMBRYO, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 
 // Per-process state
@@ -49,6 +69,11 @@ struct proc {
   struct file *ofile[NOFILE];  // Open files
   struct inode *cwd;           // Current directory
   char name[16];               // Process name (debugging)
+  struct vma vma[NVMA];        // Demand-paged memory regions
+  struct cpu *cpu;             // CPU this process last ran on
+  struct cpu *bound;           // If non-zero, only runs on this CPU
+  void (*kfn)(void*);          // Kernel thread: function to run
+  void *karg;                  // and its argument
 };
 
 // Process memory is laid out contiguously, low addresses first:
@@ -0,0 +1,126 @@
+// Buffer cache scan-resistance benchmark: alternate streaming
+// through large files with metadata work like ls and mkdir,
+// and report how often the metadata work hit in the cache.
+//
+// usage: scanbench [rounds]
+
+#include "types.h"
+#include "stat.h"
+#include "fcntl.h"
+#include "user.h"
+#include "fs.h"
+#include "bstat.h"
+
+#define NSTREAM 4
+#define NDIRS   8
+#define NBLOCKS 140  // blocks per streamed file
+
+char buf[BSIZE];
+
+void
+fail(char *msg)
+{
+  printf(1, "scanbench: %s failed\n", msg);
+  exit();
+}
+
+char*
+name(char *prefix, int i)
+{
+  static char path[32];
+  int n;
+
+  n = strlen(prefix);
+  strcpy(path, prefix);
+  path[n] = '0' + i;
+  path[n+1] = 0;
+  return path;
+}
+
+// Read each streaming file from start to end.
+void
+stream(void)
+{
+  int i, fd;
+
+  for(i = 0; i < NSTREAM; i++){
+    if((fd = open(name("sb/big", i), O_RDONLY)) < 0)
+      fail("open big");
+    while(read(fd, buf, sizeof(buf)) > 0)
+      ;
+    close(fd);
+  }
+}
+
+// List sb/ as ls does, then create and remove some directories.
+void
+metadata(void)
+{
+  char path[32];
+  struct dirent de;
+  struct stat st;
+  int i, fd;
+
+  if((fd = open("sb", O_RDONLY)) < 0)
+    fail("open sb");
+  while(read(fd, &de, sizeof(de)) == sizeof(de)){
+    if(de.inum == 0)
+      continue;
+    strcpy(path, "sb/");
+    memmove(path+3, de.name, DIRSIZ);
+    path[3+DIRSIZ] = 0;
+    if(stat(path, &st) < 0)
+      fail("stat");
+  }
+  close(fd);
+  for(i = 0; i < NDIRS; i++)
+    if(mkdir(name("sb/d", i)) < 0)
+      fail("mkdir");
+  for(i = 0; i < NDIRS; i++)
+    if(unlink(name("sb/d", i)) < 0)
+      fail("unlink");
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct bstat before, after;
+  int i, j, fd, rounds, hits, misses, start;
+
+  rounds = 10;
+  if(argc > 1)
+    rounds = atoi(argv[1]);
+
+  mkdir("sb");
+  for(i = 0; i < NSTREAM; i++){
+    if((fd = open(name("sb/big", i), O_CREATE|O_WRONLY)) < 0)
+      fail("create big");
+    memset(buf, 'a' + i, sizeof(buf));
+    for(j = 0; j < NBLOCKS; j++)
+      if(write(fd, buf, sizeof(buf)) != sizeof(buf))
+        fail("write big");
+    close(fd);
+  }
+
+  hits = misses = 0;
+  start = uptime();
+  for(i = 0; i < rounds; i++){
+    stream();
+    bstat(&before);
+    metadata();
+    bstat(&after);
+    hits += after.hits - before.hits;
+    misses += after.misses - before.misses;
+  }
+  printf(1, "%d rounds: %d ticks, metadata hits %d misses %d (%d%% hits)\n",
+         rounds, uptime() - start, hits, misses,
+         hits + misses ? 100*hits/(hits + misses) : 0);
+  bstat(&after);
+  printf(1, "cache: %d of %d buffers, %d evictions\n",
+         after.nbuf, after.maxbuf, after.evictions);
+
+  for(i = 0; i < NSTREAM; i++)
+    unlink(name("sb/big", i));
+  unlink("sb");
+  exit();
+}
@@ -0,0 +1,210 @@
+// Shared memory segments.
+//
+// A segment is a set of physical pages that several processes
+// map at the same time, so that they can exchange data with
+// ordinary loads and stores instead of system calls.
+//
+// Interface:
+// * shmget(key, size) returns the id of the segment named key,
+//   creating it with size bytes of zeroed memory if necessary.
+// * shmat(id) attaches the segment to the current process and
+//   returns its address.  Pages are mapped on first access by
+//   vmfault() in vm.c.
+// * shmdt(addr) detaches the segment attached at addr.
+// * shmrm(id) removes segment id: its key names a new segment
+//   from then on, and it is destroyed once nobody has it
+//   attached anymore.
+//
+// seg->ref counts attachments, plus one for the segment's
+// existence until shmrm(): fork() duplicates attachments, and
+// shmdt(), exec() and exit() drop them.  When the last
+// reference is dropped the segment is destroyed, so a segment
+// that is created but never attached still goes away on
+// shmrm().
+// The segment holds its own reference to each page (kincref),
+// so pages still mapped somewhere outlive it safely.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "x86.h"
+#include "proc.h"
+#include "spinlock.h"
+
+struct shmseg {
+  int key;
+  int ref;                 // attachments, plus 1 until removed
+  int removed;             // shmrm() was called
+  uint npages;             // 0 if this slot is free
+  char *page[SHMPAGES];
+};
+
+struct {
+  struct spinlock lock;
+  struct shmseg seg[NSHM];
+} shmtable;
+
+void
+shminit(void)
+{
+  initlock(&shmtable.lock, "shm");
+}
+
+// Return the id of the segment named key, creating it
+// with size bytes of zeroed memory if there is none.
+int
+shmget(int key, uint size)
+{
+  struct shmseg *s, *empty;
+  uint i, n;
+
+  if(size == 0 || size > SHMPAGES*PGSIZE)
+    return -1;
+  n = PGROUNDUP(size) / PGSIZE;
+
+  acquire(&shmtable.lock);
+  empty = 0;
+  for(s = shmtable.seg; s < &shmtable.seg[NSHM]; s++){
+    if(s->npages && !s->removed && s->key == key){
+      release(&shmtable.lock);
+      return n <= s->npages ? s - shmtable.seg : -1;
+    }
+    if(empty == 0 && s->npages == 0)
+      empty = s;
+  }
+  if((s = empty) == 0){
+    release(&shmtable.lock);
+    return -1;
+  }
+  for(i = 0; i < n; i++){
+    if((s->page[i] = kalloc()) == 0){
+      while(i-- > 0)
+        kfree(s->page[i]);
+      release(&shmtable.lock);
+      return -1;
+    }
+    memset(s->page[i], 0, PGSIZE);
+  }
+  s->key = key;
+  s->ref = 1;
+  s->removed = 0;
+  s->npages = n;
+  release(&shmtable.lock);
+  return s - shmtable.seg;
+}
+
+// Attach segment id to the current process.
+// Returns the address it is mapped at, or -1.
+int
+shmat(int id)
+{
+  struct proc *curproc = myproc();
+  struct shmseg *s;
+  struct vma *v;
+
+  if(id < 0 || id >= NSHM)
+    return -1;
+  acquire(&shmtable.lock);
+  s = &shmtable.seg[id];
+  if(s->npages == 0 || s->removed ||
+     (v = vmareserve(curproc, 0, s->npages*PGSIZE, PGSIZE)) == 0){
+    release(&shmtable.lock);
+    return -1;
+  }
+  v->flags |= VMA_WRITE | VMA_SHARED | VMA_SHM;
+  v->shm = s;
+  s->ref++;
+  release(&shmtable.lock);
+  return v->start;
+}
+
+// Detach the segment attached at addr from the current process.
+int
+shmdt(uint addr)
+{
+  struct proc *curproc = myproc();
+  struct shmseg *s;
+  struct vma *v;
+
+  for(v = curproc->vma; v < &curproc->vma[NVMA]; v++)
+    if((v->flags & VMA_SHM) && v->start == addr)
+      break;
+  if(v == &curproc->vma[NVMA])
+    return -1;
+
+  deallocuvm(curproc->pgdir, v->end, v->start);
+  lcr3(V2P(curproc->pgdir));
+  s = v->shm;
+  memset(v, 0, sizeof(*v));
+  shmput(s);
+  return 0;
+}
+
+// Remove segment id, destroying it once it is detached
+// everywhere.
+int
+shmrm(int id)
+{
+  struct shmseg *s;
+
+  if(id < 0 || id >= NSHM)
+    return -1;
+  acquire(&shmtable.lock);
+  s = &shmtable.seg[id];
+  if(s->npages == 0 || s->removed){
+    release(&shmtable.lock);
+    return -1;
+  }
+  s->removed = 1;
+  release(&shmtable.lock);
+  shmput(s);
+  return 0;
+}
+
+// Return page i of s with a reference taken for the caller.
+char*
+shmpage(struct shmseg *s, uint i)
+{
+  char *page;
+
+  acquire(&shmtable.lock);
+  page = 0;
+  if(i < s->npages){
+    page = s->page[i];
+    kincref(page);
+  }
+  release(&shmtable.lock);
+  return page;
+}
+
+// Record another attachment of s, for fork().
+void
+shmdup(struct shmseg *s)
+{
+  acquire(&shmtable.lock);
+  if(s->ref < 1)
+    panic("shmdup");
+  s->ref++;
+  release(&shmtable.lock);
+}
+
+// Drop an attachment of s, destroying s if it was the last.
+void
+shmput(struct shmseg *s)
+{
+  uint i;
+
+  acquire(&shmtable.lock);
+  if(s->ref < 1)
+    panic("shmput");
+  if(--s->ref == 0){
+    for(i = 0; i < s->npages; i++){
+      kfree(s->page[i]);
+      s->page[i] = 0;
+    }
+    s->npages = 0;
+  }
+  release(&shmtable.lock);
+}
@@ -0,0 +1,111 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+#define KEY 0x5348
+#define RINGSIZE 64
+#define NITEMS 5000
+
+// Single-producer, single-consumer ring buffer that lives
+// entirely in a shared memory segment: items move between
+// the two processes without any system calls.
+struct ring {
+  volatile uint head;   // next slot the producer fills
+  volatile uint tail;   // next slot the consumer empties
+  volatile int item[RINGSIZE];
+};
+
+void
+fail(char *msg)
+{
+  printf(1, "shmtest: %s failed\n", msg);
+  exit();
+}
+
+void
+producer(struct ring *r)
+{
+  int i;
+
+  for(i = 1; i <= NITEMS; i++){
+    while(r->head - r->tail == RINGSIZE)
+      sleep(1);  // full
+    r->item[r->head % RINGSIZE] = i;
+    r->head++;
+  }
+}
+
+int
+consumer(struct ring *r)
+{
+  int i, sum;
+
+  sum = 0;
+  for(i = 1; i <= NITEMS; i++){
+    while(r->head == r->tail)
+      sleep(1);  // empty
+    sum += r->item[r->tail % RINGSIZE];
+    r->tail++;
+  }
+  return sum;
+}
+
+// Segments that are created and removed without ever being
+// attached must not use up the segment table.
+void
+getnoattach(void)
+{
+  int i, id;
+
+  for(i = 0; i < 64; i++){
+    if((id = shmget(KEY + 1, 4096)) < 0)
+      fail("shmget without shmat");
+    if(shmrm(id) < 0)
+      fail("shmrm without shmat");
+  }
+  if(shmrm(id) == 0)
+    fail("double shmrm");
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct ring *r;
+  int id, id2, sum, start;
+
+  if((id = shmget(KEY, sizeof(struct ring))) < 0)
+    fail("shmget");
+  if(shmget(KEY, sizeof(struct ring)) != id)
+    fail("shmget same key");
+  if((r = shmat(id)) == (void*)-1)
+    fail("shmat");
+  // Removed, the segment lives on while it is attached,
+  // and its key names a new one.
+  if(shmrm(id) < 0)
+    fail("shmrm");
+  if(shmat(id) != (void*)-1)
+    fail("shmat after shmrm");
+  if((id2 = shmget(KEY, sizeof(struct ring))) < 0 || id2 == id)
+    fail("shmget after shmrm");
+  shmrm(id2);
+
+  start = uptime();
+  if(fork() == 0){
+    producer(r);
+    exit();
+  }
+  sum = consumer(r);
+  wait();
+  if(sum != NITEMS*(NITEMS+1)/2)
+    fail("ring contents");
+  printf(1, "%d items through shared ring in %d ticks\n",
+         NITEMS, uptime() - start);
+
+  if(shmdt(r) < 0)
+    fail("shmdt");
+  if(shmdt(r) == 0)
+    fail("double shmdt");
+  getnoattach();
+  printf(1, "shmtest ok\n");
+  exit();
+}
@@ -19,7 +19,8 @@ fetchint(uint addr, int *ip)
 {
   struct proc *curproc = myproc();
 
-  if(addr >= curproc->sz || addr+4 > curproc->sz)
+  if((addr >= curproc->sz || addr+4 > curproc->sz) &&
+     vmalookup(curproc, addr, 4) == 0)
     return -1;
   *ip = *(int*)(addr);
   return 0;
@@ -32,12 +33,16 @@ int
 fetchstr(uint addr, char **pp)
 {
   char *s, *ep;
+  struct vma *v;
   struct proc *curproc = myproc();
 
-  if(addr >= curproc->sz)
+  if(addr < curproc->sz)
+    ep = (char*)curproc->sz;
+  else if((v = vmalookup(curproc, addr, 1)) != 0)
+    ep = (char*)v->end;
+  else
     return -1;
   *pp = (char*)addr;
-  ep = (char*)curproc->sz;
   for(s = *pp; s < ep; s++){
     if(*s == 0)
       return s - *pp;
@@ -63,7 +68,12 @@ argptr(int n, char **pp, int size)
  
   if(argint(n, &i) < 0)
     return -1;
-  if(size < 0 || (uint)i >= curproc->sz || (uint)i+size > curproc->sz)
+  if(size < 0)
+    return -1;
+  if(((uint)i >= curproc->sz || (uint)i+size > curproc->sz) &&
+     vmalookup(curproc, i, size) == 0)
+    return -1;
+  if(vmtouch(curproc, i, size) < 0)
     return -1;
   *pp = (char*)i;
   return 0;
@@ -114,6 +124,14 @@ extern int sys_cv_wait(void);
 extern int sys_cv_signal(void);
 extern int sys_acquire_lock(void);
 extern int sys_release_lock(void);
+extern int sys_mmap(void);
+extern int sys_munmap(void);
+extern int sys_shmget(void);
+extern int sys_shmat(void);
+extern int sys_shmdt(void);
+extern int sys_shmrm(void);
+extern int sys_bstat(void);
+extern int sys_fsync(void);
 
 static int (*syscalls[])(void) = {
 [SYS_fork]    sys_fork,
@@ -148,6 +166,14 @@ static int (*syscalls[])(void) = {
 [SYS_cv_signal] sys_cv_signal,
 [SYS_acquire_lock] sys_acquire_lock,
 [SYS_release_lock] sys_release_lock,
+[SYS_mmap]    sys_mmap,
+[SYS_munmap]  sys_munmap,
+[SYS_shmget]  sys_shmget,
+[SYS_shmat]   sys_shmat,
+[SYS_shmdt]   sys_shmdt,
+[SYS_shmrm]   sys_shmrm,
+[SYS_bstat]   sys_bstat,
+[SYS_fsync]   sys_fsync,
 };
 
 void
@@ -30,4 +30,12 @@
 #define SYS_inc_counter 40
 #define SYS_dec_counter 41
 #define SYS_reset_counter 42
-#define SYS_get_counter 43
\ No newline at end of file
+#define SYS_get_counter 43
+#define SYS_mmap   50
+#define SYS_munmap 51
+#define SYS_shmget 52
+#define SYS_shmat  53
+#define SYS_shmdt  54
+#define SYS_bstat  55
+#define SYS_fsync  56
+#define SYS_shmrm  57
\ No newline at end of file
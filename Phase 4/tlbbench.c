@@ -0,0 +1,53 @@
+// Compare the cost of touching a large region mapped with
+// 4KB pages against the same region mapped with 4MB pages.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "mman.h"
+
+#define PGSIZE 4096
+#define REGION (16*1024*1024)
+#define ROUNDS 200
+
+// Touch one word in each 4KB page of p, ROUNDS times.
+int
+touch(char *p)
+{
+  int i, r, start;
+
+  for(i = 0; i < REGION; i += PGSIZE)
+    p[i] = 1;  // fault everything in first
+  start = uptime();
+  for(r = 0; r < ROUNDS; r++)
+    for(i = 0; i < REGION; i += PGSIZE)
+      p[i] += r;
+  return uptime() - start;
+}
+
+int
+main(int argc, char *argv[])
+{
+  char *p;
+  int t;
+
+  p = mmap(0, REGION, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+  if(p == MAP_FAILED){
+    printf(1, "tlbbench: mmap failed\n");
+    exit();
+  }
+  t = touch(p);
+  printf(1, "4KB pages: %d ticks\n", t);
+  munmap(p, REGION);
+
+  p = mmap(0, REGION, PROT_READ|PROT_WRITE,
+           MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGE, -1, 0);
+  if(p == MAP_FAILED){
+    printf(1, "tlbbench: mmap MAP_HUGE failed\n");
+    exit();
+  }
+  t = touch(p);
+  printf(1, "4MB pages: %d ticks\n", t);
+  munmap(p, REGION);
+  exit();
+}
@@ -0,0 +1,75 @@
+// Scratch file benchmark: create, write, read back and delete
+// small files over and over, as a build or a shell script
+// does with its temporary files, first in / (the disk) and
+// then in /tmp (the RAM file system).
+//
+// usage: tmpbench [files]
+
+#include "types.h"
+#include "stat.h"
+#include "fcntl.h"
+#include "user.h"
+
+#define FILESZ 2048
+#define MAXFILES 1000
+
+char buf[FILESZ];
+
+// Churn through n files in directory dir.
+// Returns the number of ticks it took, or -1.
+int
+churn(char *dir, int n)
+{
+  char path[32];
+  int i, fd, start, len;
+
+  strcpy(path, dir);
+  len = strlen(path);
+  strcpy(path + len, "/tmpbench.x");
+  len = strlen(path) - 1;
+
+  start = uptime();
+  for(i = 0; i < n; i++){
+    path[len] = 'a' + i % 26;
+    if((fd = open(path, O_CREATE|O_RDWR)) < 0)
+      return -1;
+    if(write(fd, buf, FILESZ) != FILESZ){
+      close(fd);
+      return -1;
+    }
+    close(fd);
+    if((fd = open(path, O_RDONLY)) < 0)
+      return -1;
+    if(read(fd, buf, FILESZ) != FILESZ){
+      close(fd);
+      return -1;
+    }
+    close(fd);
+    if(unlink(path) < 0)
+      return -1;
+  }
+  return uptime() - start;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int n, disk, tmp;
+
+  n = 100;
+  if(argc > 1)
+    n = atoi(argv[1]);
+  if(n < 1 || n > MAXFILES){
+    printf(2, "usage: tmpbench [files], at most %d\n", MAXFILES);
+    exit();
+  }
+  memset(buf, 't', FILESZ);
+
+  if((disk = churn("", n)) < 0 || (tmp = churn("/tmp", n)) < 0){
+    printf(1, "tmpbench: file operation failed\n");
+    exit();
+  }
+  printf(1, "%d files of %d bytes: / %d ticks, /tmp %d ticks\n",
+         n, FILESZ, disk, tmp);
+  exit();
+}
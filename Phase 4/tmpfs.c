@@ -0,0 +1,201 @@
+// RAM file system.
+//
+// The tmpfs keeps its i-nodes in a table in memory and file
+// contents in pages from kalloc(), so nothing done on it goes
+// through the log or the disk, and it is empty at every boot.
+// The kernel mounts it on /tmp (see mount() in fs.c).
+//
+// Its i-nodes are cached and locked in the inode cache like
+// disk i-nodes, with dev TMPDEV.  fs.c calls the functions
+// here where it would otherwise read or write the disk:
+// * tmpialloc(), tmpiload() and tmpiupdate() stand in for
+//   the on-disk i-nodes,
+// * tmpread(), tmpwrite() and tmpitrunc() for the blocks,
+// * tmppage() gives dirscan() the page holding an offset.
+//
+// Each i-node has an index page holding pointers to its data
+// pages, so a file can be at most PGSIZE/4 pages long.
+// Writes can't leave holes (off <= size), so every page below
+// the size of a file exists.  Callers hold ip->lock, which
+// protects the i-node's pages and fields; tmpfs.lock protects
+// allocation of the i-nodes.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "stat.h"
+#include "mmu.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+
+#define NTMPPG (PGSIZE / sizeof(char*))  // max pages in a file
+#define min(a, b) ((a) < (b) ? (a) : (b))
+
+struct tmpinode {
+  short type;      // 0 if free
+  short major;
+  short minor;
+  short nlink;
+  uint size;
+  uint flags;
+  char **page;     // index page, or 0
+};
+
+struct {
+  struct spinlock lock;
+  struct tmpinode inode[NTMPINODE];
+} tmpfs;
+
+// Set up the empty root directory.
+void
+tmpfsinit(void)
+{
+  struct tmpinode *tp;
+  struct dirent *de;
+
+  initlock(&tmpfs.lock, "tmpfs");
+  tp = &tmpfs.inode[ROOTINO];
+  if((tp->page = (char**)kalloc()) == 0)
+    panic("tmpfsinit");
+  memset(tp->page, 0, PGSIZE);
+  if((tp->page[0] = kalloc()) == 0)
+    panic("tmpfsinit");
+  memset(tp->page[0], 0, PGSIZE);
+  de = (struct dirent*)tp->page[0];
+  de[0].inum = ROOTINO;
+  safestrcpy(de[0].name, ".", DIRSIZ);
+  de[1].inum = ROOTINO;
+  safestrcpy(de[1].name, "..", DIRSIZ);
+  tp->type = T_DIR;
+  tp->nlink = 1;
+  tp->size = 2*sizeof(*de);
+}
+
+// Allocate an i-node of the given type.
+// Returns its i-number, or 0 if there is none free.
+uint
+tmpialloc(short type)
+{
+  struct tmpinode *tp;
+
+  acquire(&tmpfs.lock);
+  for(tp = &tmpfs.inode[1]; tp < &tmpfs.inode[NTMPINODE]; tp++){
+    if(tp->type == 0){
+      memset(tp, 0, sizeof(*tp));
+      tp->type = type;
+      release(&tmpfs.lock);
+      return tp - tmpfs.inode;
+    }
+  }
+  release(&tmpfs.lock);
+  return 0;
+}
+
+// Fill in the cached i-node ip, as ilock() does from the disk.
+void
+tmpiload(struct inode *ip)
+{
+  struct tmpinode *tp = &tmpfs.inode[ip->inum];
+
+  ip->type = tp->type;
+  ip->major = tp->major;
+  ip->minor = tp->minor;
+  ip->nlink = tp->nlink;
+  ip->size = tp->size;
+  ip->dsize = tp->size;
+  ip->flags = tp->flags;
+}
+
+// Copy the cached i-node ip back, as iupdate() does to the disk.
+void
+tmpiupdate(struct inode *ip)
+{
+  struct tmpinode *tp = &tmpfs.inode[ip->inum];
+
+  acquire(&tmpfs.lock);
+  tp->type = ip->type;
+  tp->major = ip->major;
+  tp->minor = ip->minor;
+  tp->nlink = ip->nlink;
+  tp->size = ip->size;
+  tp->flags = ip->flags;
+  release(&tmpfs.lock);
+}
+
+// Free the pages of ip.
+void
+tmpitrunc(struct inode *ip)
+{
+  struct tmpinode *tp = &tmpfs.inode[ip->inum];
+  int i;
+
+  if(tp->page == 0)
+    return;
+  for(i = 0; i < NTMPPG && tp->page[i]; i++)
+    kfree(tp->page[i]);
+  kfree((char*)tp->page);
+  tp->page = 0;
+}
+
+// The page of ip holding offset off, or 0 if off is
+// past the pages of ip.
+char*
+tmppage(struct inode *ip, uint off)
+{
+  struct tmpinode *tp = &tmpfs.inode[ip->inum];
+
+  if(tp->page == 0 || off/PGSIZE >= NTMPPG)
+    return 0;
+  return tp->page[off/PGSIZE];
+}
+
+// Read n bytes at offset off of ip, which readi() has
+// checked to be within the file.
+int
+tmpread(struct inode *ip, char *dst, uint off, uint n)
+{
+  uint tot, m;
+
+  for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
+    m = min(n - tot, PGSIZE - off%PGSIZE);
+    memmove(dst, tmppage(ip, off) + off%PGSIZE, m);
+  }
+  return n;
+}
+
+// Write n bytes at offset off of ip, which must not be past
+// its end, allocating pages as the file grows.  Returns the
+// number of bytes written, or -1 if none could be.
+int
+tmpwrite(struct inode *ip, char *src, uint off, uint n)
+{
+  struct tmpinode *tp = &tmpfs.inode[ip->inum];
+  uint tot, m;
+  char *pg;
+
+  if(tp->page == 0){
+    if((tp->page = (char**)kalloc()) == 0)
+      return -1;
+    memset(tp->page, 0, PGSIZE);
+  }
+  for(tot=0; tot<n; tot+=m, off+=m, src+=m){
+    if(off/PGSIZE >= NTMPPG)
+      break;
+    if((pg = tp->page[off/PGSIZE]) == 0){
+      if((pg = kalloc()) == 0)
+        break;
+      memset(pg, 0, PGSIZE);
+      tp->page[off/PGSIZE] = pg;
+    }
+    m = min(n - tot, PGSIZE - off%PGSIZE);
+    memmove(pg + off%PGSIZE, src, m);
+  }
+  if(tot > 0 && off > ip->size){
+    ip->size = off;
+    ip->dsize = off;
+    tmpiupdate(ip);
+  }
+  return tot > 0 || n == 0 ? tot : -1;
+}
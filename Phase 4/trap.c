@@ -53,6 +53,7 @@ trap(struct trapframe *tf)
       ticks++;
       wakeup(&ticks);
       release(&tickslock);
+      worktick();
     }
     lapiceoi();
     break;
@@ -78,8 +79,19 @@ trap(struct trapframe *tf)
     lapiceoi();
     break;
 
+  case T_PGFLT:
+    // Demand-paged or copy-on-write page (see vmfault in vm.c).
+    if(myproc() != 0 && vmfault(myproc(), rcr2(), tf->err) == 0)
+      break;
+    // Otherwise a real fault; fall through.
+
   //PAGEBREAK: 13
   default:
+    // PCI devices use whatever IRQ the BIOS gave them.
+    if(tf->trapno >= T_IRQ0 && virtiointr(tf->trapno - T_IRQ0) == 0){
+      lapiceoi();
+      break;
+    }
     if(myproc() == 0 || (tf->cs&3) == 0){
       // In kernel, it must be our mistake.
       cprintf("unexpected trap %d from cpu %d eip %x (cr2=0x%x)\n",
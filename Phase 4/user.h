@@ -2,6 +2,7 @@ struct stat;
 struct rtcdate;
 struct spinlock;
 struct condvar;
+struct bstat;
 
 // system calls
 int fork(void);
@@ -37,6 +38,14 @@ void cv_wait(struct condvar*);
 void cv_signal(struct condvar*);
 void acquire_lock(struct spinlock*);
 void release_lock(struct spinlock*);
+void* mmap(void*, int, int, int, int, int);
+int munmap(void*, int);
+int shmget(int, int);
+void* shmat(int);
+int shmdt(void*);
+int shmrm(int);
+int bstat(struct bstat*);
+int fsync(int);
 
 // ulib.c
 int stat(const char*, struct stat*);
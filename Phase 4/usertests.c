@@ -931,6 +931,50 @@ bigdir(void)
   printf(1, "bigdir ok\n");
 }
 
+// running out of i-nodes in the RAM file system on /tmp
+void
+tmpfull(void)
+{
+  int i, n, fd;
+  char name[10];
+
+  printf(1, "tmpfull test\n");
+  strcpy(name, "/tmp/f");
+  name[8] = '\0';
+  for(n = 0; n < 500; n++){
+    name[6] = '0' + (n / 64);
+    name[7] = '0' + (n % 64);
+    if((fd = open(name, O_CREATE|O_RDWR)) < 0)
+      break;
+    close(fd);
+  }
+  if(n == 0 || n == 500){
+    printf(1, "tmpfull: %d files created\n", n);
+    exit();
+  }
+  if(mkdir("/tmp/d") == 0){
+    printf(1, "tmpfull: mkdir succeeded\n");
+    exit();
+  }
+
+  for(i = 0; i < n; i++){
+    name[6] = '0' + (i / 64);
+    name[7] = '0' + (i % 64);
+    if(unlink(name) != 0){
+      printf(1, "tmpfull unlink failed\n");
+      exit();
+    }
+  }
+  if((fd = open("/tmp/f", O_CREATE|O_RDWR)) < 0){
+    printf(1, "tmpfull: create after unlink failed\n");
+    exit();
+  }
+  close(fd);
+  unlink("/tmp/f");
+
+  printf(1, "tmpfull ok\n");
+}
+
 void
 subdir(void)
 {
@@ -1794,6 +1838,7 @@ main(int argc, char *argv[])
   iref();
   forktest();
   bigdir(); // slow
+  tmpfull();
 
   uio();
 
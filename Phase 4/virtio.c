@@ -0,0 +1,242 @@
+// Driver for a virtio block device over legacy PCI
+// (QEMU's -device virtio-blk-pci), used for disk 1.
+//
+// Unlike the IDE disk, the device takes many requests at
+// once: each is a chain of three descriptors (header, data,
+// status) in the virtqueue, and the interrupt handler
+// completes whichever requests the device has finished.
+// The interface is the same as ide.c's: virtiorwstart()
+// queues a request and virtiorwwait() waits for it.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "proc.h"
+#include "x86.h"
+#include "traps.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "buf.h"
+#include "pci.h"
+#include "virtio.h"
+
+#define NDESC 256  // most descriptors the queue memory has room for
+
+// The queue must be physically contiguous and page aligned,
+// so it lives in the kernel's bss rather than in kalloc()
+// pages: descriptors and available ring first, then the used
+// ring on the next page boundary.
+static char vqmem[3*PGSIZE] __attribute__((aligned(PGSIZE)));
+
+static struct {
+  struct spinlock lock;
+  ushort iobase;             // 0 if there is no device
+  int irq;
+  uint qsz;                  // descriptors in the queue
+
+  struct virtq_desc *desc;
+  struct virtq_avail *avail;
+  struct virtq_used *used;
+  ushort usedidx;            // next used entry to look at
+
+  char free[NDESC];          // is a descriptor free?
+  int nfree;
+
+  // For each request in flight, indexed by the head descriptor.
+  struct buf *buf[NDESC];
+  struct virtio_blk_req hdr[NDESC];
+  uchar status[NDESC];
+} vdisk;
+
+// Look for a virtio block device and set it up.
+// Returns 0 if there is one, -1 if not.
+int
+virtioinit(void)
+{
+  struct pcidev d;
+  ushort io;
+  uint i;
+
+  if(pcifind(VIRTIO_VENDOR, VIRTIO_DEV_BLK, PCI_ANY, PCI_ANY, &d) < 0 ||
+     !(d.bar[0] & PCI_BAR_IO))
+    return -1;
+  pcienable(&d);
+  io = PCI_BAR_IOADDR(d.bar[0]);
+
+  outb(io + VIRTIO_STATUS, 0);  // reset
+  outb(io + VIRTIO_STATUS, VIRTIO_STATUS_ACK);
+  outb(io + VIRTIO_STATUS, VIRTIO_STATUS_ACK | VIRTIO_STATUS_DRIVER);
+  outl(io + VIRTIO_GUEST_FEATURES, 0);  // none of the optional features
+
+  outw(io + VIRTIO_QUEUE_SEL, 0);
+  vdisk.qsz = inw(io + VIRTIO_QUEUE_SIZE);
+  if(vdisk.qsz == 0 || vdisk.qsz > NDESC ||
+     PGROUNDUP(16*vdisk.qsz + 6 + 2*vdisk.qsz) + 6 + 8*vdisk.qsz > sizeof(vqmem)){
+    outb(io + VIRTIO_STATUS, VIRTIO_STATUS_FAILED);
+    return -1;
+  }
+  memset(vqmem, 0, sizeof(vqmem));
+  vdisk.desc = (struct virtq_desc*)vqmem;
+  vdisk.avail = (struct virtq_avail*)(vqmem + 16*vdisk.qsz);
+  vdisk.used = (struct virtq_used*)(vqmem + PGROUNDUP(16*vdisk.qsz + 6 + 2*vdisk.qsz));
+  outl(io + VIRTIO_QUEUE_PFN, V2P(vqmem) >> PTXSHIFT);
+
+  initlock(&vdisk.lock, "virtio");
+  for(i = 0; i < vdisk.qsz; i++)
+    vdisk.free[i] = 1;
+  vdisk.nfree = vdisk.qsz;
+  vdisk.iobase = io;
+  vdisk.irq = d.irq;
+  ioapicenable(d.irq, ncpu - 1);
+
+  outb(io + VIRTIO_STATUS,
+       VIRTIO_STATUS_ACK | VIRTIO_STATUS_DRIVER | VIRTIO_STATUS_DRIVER_OK);
+  cprintf("virtio: block device at 0x%x irq %d, %d descriptors\n",
+          io, d.irq, vdisk.qsz);
+  return 0;
+}
+
+// Take a free descriptor.  Caller holds vdisk.lock.
+static int
+allocdesc(void)
+{
+  int i;
+
+  for(i = 0; i < vdisk.qsz; i++){
+    if(vdisk.free[i]){
+      vdisk.free[i] = 0;
+      vdisk.nfree--;
+      return i;
+    }
+  }
+  panic("virtio: allocdesc");
+}
+
+// Free the descriptor chain starting at i.  Caller holds vdisk.lock.
+static void
+freechain(int i)
+{
+  int flags;
+
+  for(;;){
+    flags = vdisk.desc[i].flags;
+    vdisk.free[i] = 1;
+    vdisk.nfree++;
+    if(!(flags & VRING_DESC_F_NEXT))
+      break;
+    i = vdisk.desc[i].next;
+  }
+  wakeup(&vdisk.free);
+}
+
+// Queue b for the disk and return without waiting.
+// See iderwstart() in ide.c.
+void
+virtiorwstart(struct buf *b)
+{
+  int d0, d1, d2, write;
+  uint sector;
+
+  if(!holdingsleep(&b->lock))
+    panic("virtiorw: buf not locked");
+  if((b->flags & (B_VALID|B_DIRTY)) == B_VALID)
+    panic("virtiorw: nothing to do");
+  if(b->blockno >= FSSIZE)
+    panic("incorrect blockno");
+
+  write = (b->flags & B_DIRTY) != 0;
+  sector = b->blockno * (BSIZE/512);
+
+  acquire(&vdisk.lock);
+  while(vdisk.nfree < 3)
+    sleep(&vdisk.free, &vdisk.lock);
+  d0 = allocdesc();
+  d1 = allocdesc();
+  d2 = allocdesc();
+
+  vdisk.hdr[d0].type = write ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN;
+  vdisk.hdr[d0].reserved = 0;
+  vdisk.hdr[d0].sector = sector;
+  vdisk.hdr[d0].sectorhi = 0;
+  vdisk.status[d0] = 0xff;  // device writes 0 on success
+  vdisk.buf[d0] = b;
+
+  vdisk.desc[d0].addr = V2P(&vdisk.hdr[d0]);
+  vdisk.desc[d0].addrhi = 0;
+  vdisk.desc[d0].len = sizeof(vdisk.hdr[d0]);
+  vdisk.desc[d0].flags = VRING_DESC_F_NEXT;
+  vdisk.desc[d0].next = d1;
+
+  vdisk.desc[d1].addr = V2P(b->data);
+  vdisk.desc[d1].addrhi = 0;
+  vdisk.desc[d1].len = BSIZE;
+  vdisk.desc[d1].flags = VRING_DESC_F_NEXT | (write ? 0 : VRING_DESC_F_WRITE);
+  vdisk.desc[d1].next = d2;
+
+  vdisk.desc[d2].addr = V2P(&vdisk.status[d0]);
+  vdisk.desc[d2].addrhi = 0;
+  vdisk.desc[d2].len = 1;
+  vdisk.desc[d2].flags = VRING_DESC_F_WRITE;
+  vdisk.desc[d2].next = 0;
+
+  // Publish the chain, then the new index, then tell the device.
+  vdisk.avail->ring[vdisk.avail->idx % vdisk.qsz] = d0;
+  __sync_synchronize();
+  vdisk.avail->idx++;
+  __sync_synchronize();
+  outw(vdisk.iobase + VIRTIO_QUEUE_NOTIFY, 0);
+
+  release(&vdisk.lock);
+}
+
+// Wait for the request for b started by virtiorwstart().
+void
+virtiorwwait(struct buf *b)
+{
+  acquire(&vdisk.lock);
+  while((b->flags & (B_VALID|B_DIRTY)) != B_VALID)
+    sleep(b, &vdisk.lock);
+  release(&vdisk.lock);
+}
+
+// Interrupt handler.  Returns -1 if irq is not ours.
+int
+virtiointr(int irq)
+{
+  struct buf *b, *done;
+  int id;
+
+  if(vdisk.iobase == 0 || irq != vdisk.irq)
+    return -1;
+  inb(vdisk.iobase + VIRTIO_ISR);  // acknowledge
+
+  acquire(&vdisk.lock);
+  done = 0;
+  while(vdisk.usedidx != vdisk.used->idx){
+    __sync_synchronize();
+    id = vdisk.used->ring[vdisk.usedidx % vdisk.qsz].id;
+    if(vdisk.status[id] != 0)
+      panic("virtio: request failed");
+    b = vdisk.buf[id];
+    vdisk.buf[id] = 0;
+    b->flags |= B_VALID;
+    b->flags &= ~B_DIRTY;
+    wakeup(b);
+    if(b->flags & B_ASYNC){
+      b->qnext = done;
+      done = b;
+    }
+    freechain(id);
+    vdisk.usedidx++;
+  }
+  release(&vdisk.lock);
+
+  while((b = done) != 0){
+    done = b->qnext;
+    bdone(b);
+  }
+  return 0;
+}
@@ -0,0 +1,61 @@
+// Legacy virtio over PCI, as used by virtio.c.
+// See the virtio 1.0 specification, section 4.1.4.8.
+
+#define VIRTIO_VENDOR         0x1af4
+#define VIRTIO_DEV_BLK        0x1001  // transitional block device
+
+// I/O registers, from BAR0
+#define VIRTIO_HOST_FEATURES  0x00    // 32 bits
+#define VIRTIO_GUEST_FEATURES 0x04    // 32 bits
+#define VIRTIO_QUEUE_PFN      0x08    // 32 bits, physical page number
+#define VIRTIO_QUEUE_SIZE     0x0C    // 16 bits
+#define VIRTIO_QUEUE_SEL      0x0E    // 16 bits
+#define VIRTIO_QUEUE_NOTIFY   0x10    // 16 bits
+#define VIRTIO_STATUS         0x12    // 8 bits
+#define VIRTIO_ISR            0x13    // 8 bits, read to acknowledge
+
+// Status register bits
+#define VIRTIO_STATUS_ACK       0x01
+#define VIRTIO_STATUS_DRIVER    0x02
+#define VIRTIO_STATUS_DRIVER_OK 0x04
+#define VIRTIO_STATUS_FAILED    0x80
+
+// Virtqueue descriptor
+struct virtq_desc {
+  uint addr;         // physical address, low 32 bits
+  uint addrhi;       // high 32 bits, always 0 here
+  uint len;
+  ushort flags;
+  ushort next;
+};
+#define VRING_DESC_F_NEXT  1  // chained with another descriptor
+#define VRING_DESC_F_WRITE 2  // device writes (vs reads)
+
+// Ring of descriptor chains handed to the device
+struct virtq_avail {
+  ushort flags;
+  ushort idx;        // where the driver puts the next entry
+  ushort ring[];
+};
+
+struct virtq_used_elem {
+  uint id;           // head of the completed descriptor chain
+  uint len;
+};
+
+// Ring of descriptor chains the device has finished
+struct virtq_used {
+  ushort flags;
+  ushort idx;        // where the device puts the next entry
+  struct virtq_used_elem ring[];
+};
+
+// Block request header, the first descriptor of a request
+struct virtio_blk_req {
+  uint type;
+  uint reserved;
+  uint sector;       // low 32 bits
+  uint sectorhi;
+};
+#define VIRTIO_BLK_T_IN  0  // read the disk
+#define VIRTIO_BLK_T_OUT 1  // write the disk
@@ -6,6 +6,12 @@
 #include "mmu.h"
 #include "proc.h"
 #include "elf.h"
+#include "stat.h"
+#include "fs.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "file.h"
+#include "mman.h"
 
 extern char data[];  // defined by kernel.ld
 pde_t *kpgdir;  // for use in scheduler()
@@ -39,6 +45,8 @@ walkpgdir(pde_t *pgdir, const void *va, int alloc)
   pte_t *pgtab;
 
   pde = &pgdir[PDX(va)];
+  if(*pde & PTE_PS)
+    return 0;  // 4MB page, there is no page table
   if(*pde & PTE_P){
     pgtab = (pte_t*)P2V(PTE_ADDR(*pde));
   } else {
@@ -99,6 +107,13 @@ mappages(pde_t *pgdir, void *va, uint size, uint pa, int perm)
 // The kernel allocates physical memory for its heap and for user memory
 // between V2P(end) and the end of physical memory (PHYSTOP)
 // (directly addressable from end..P2V(PHYSTOP)).
+//
+// The kernel half is built once, in kpgdir, using 4MB pages
+// wherever the mapping is 4MB aligned, and marked global so its
+// TLB entries survive process switches.  It never changes.
+// Every other page table copies kpgdir's kernel page directory
+// entries, so they all share the kernel's page tables (see
+// setupkvm).
 
 // This table defines the kernel's mappings, which are present in
 // every process's page table.
@@ -114,33 +129,62 @@ static struct kmap {
  { (void*)DEVSPACE, DEVSPACE,      0,         PTE_W}, // more devices
 };
 
-// Set up kernel part of a page table.
+// Map size bytes at va to pa like mappages(), but use a 4MB
+// page for each 4MB-aligned piece.  size may wrap around to 0.
+static int
+mapkernel(pde_t *pgdir, uint va, uint size, uint pa, int perm)
+{
+  uint n;
+
+  while(size > 0){
+    if(va % SUPERPGSIZE == 0 && pa % SUPERPGSIZE == 0 && size >= SUPERPGSIZE){
+      if(pgdir[PDX(va)] & PTE_P)
+        panic("remap");
+      pgdir[PDX(va)] = pa | perm | PTE_P | PTE_PS | PTE_G;
+      n = SUPERPGSIZE;
+    } else {
+      if(mappages(pgdir, (void*)va, PGSIZE, pa, perm | PTE_G) < 0)
+        return -1;
+      n = PGSIZE;
+    }
+    va += n;
+    pa += n;
+    size -= n;
+  }
+  return 0;
+}
+
+// Set up kernel part of a page table by sharing kpgdir's.
 pde_t*
 setupkvm(void)
 {
   pde_t *pgdir;
-  struct kmap *k;
 
   if((pgdir = (pde_t*)kalloc()) == 0)
     return 0;
-  memset(pgdir, 0, PGSIZE);
-  if (P2V(PHYSTOP) > (void*)DEVSPACE)
-    panic("PHYSTOP too high");
-  for(k = kmap; k < &kmap[NELEM(kmap)]; k++)
-    if(mappages(pgdir, k->virt, k->phys_end - k->phys_start,
-                (uint)k->phys_start, k->perm) < 0) {
-      freevm(pgdir);
-      return 0;
-    }
+  memset(pgdir, 0, PDX(KERNBASE)*sizeof(pde_t));
+  memmove(&pgdir[PDX(KERNBASE)], &kpgdir[PDX(KERNBASE)],
+          (NPDENTRIES - PDX(KERNBASE))*sizeof(pde_t));
   return pgdir;
 }
 
 // Allocate one page table for the machine for the kernel address
-// space for scheduler processes.
+// space for scheduler processes.  Its kernel half is shared by
+// every process's page table, so it must not change later.
 void
 kvmalloc(void)
 {
-  kpgdir = setupkvm();
+  struct kmap *k;
+
+  if (P2V(PHYSTOP) > (void*)DEVSPACE)
+    panic("PHYSTOP too high");
+  if((kpgdir = (pde_t*)kalloc()) == 0)
+    panic("kvmalloc");
+  memset(kpgdir, 0, PGSIZE);
+  for(k = kmap; k < &kmap[NELEM(kmap)]; k++)
+    if(mapkernel(kpgdir, (uint)k->virt, k->phys_end - k->phys_start,
+                 (uint)k->phys_start, k->perm) < 0)
+      panic("kvmalloc");
   switchkvm();
 }
 
@@ -153,6 +197,11 @@ switchkvm(void)
 }
 
 // Switch TSS and h/w page table to correspond to process p.
+// The scheduler does not switch back to kpgdir, so if p is the
+// last process this CPU ran, and it has not run anywhere else
+// since, its page table is still loaded and the TLB still valid.
+// Each CPU holds a reference to the page directory it has
+// loaded, so it stays valid after the process exits or execs.
 void
 switchuvm(struct proc *p)
 {
@@ -173,7 +222,14 @@ switchuvm(struct proc *p)
   // forbids I/O instructions (e.g., inb and outb) from user space
   mycpu()->ts.iomb = (ushort) 0xFFFF;
   ltr(SEG_TSS << 3);
-  lcr3(V2P(p->pgdir));  // switch to process's address space
+  if(mycpu()->pgdir != p->pgdir || p->cpu != mycpu()){
+    kincref((char*)p->pgdir);
+    lcr3(V2P(p->pgdir));  // switch to process's address space
+    if(mycpu()->pgdir)
+      kfree((char*)mycpu()->pgdir);
+    mycpu()->pgdir = p->pgdir;
+    p->cpu = mycpu();
+  }
   popcli();
 }
 
@@ -279,7 +335,7 @@ deallocuvm(pde_t *pgdir, uint oldsz, uint newsz)
 }
 
 // Free a page table and all the physical memory pages
-// in the user part.
+// in the user part.  The kernel part is shared with kpgdir.
 void
 freevm(pde_t *pgdir)
 {
@@ -288,11 +344,14 @@ freevm(pde_t *pgdir)
   if(pgdir == 0)
     panic("freevm: no pgdir");
   deallocuvm(pgdir, KERNBASE, 0);
-  for(i = 0; i < NPDENTRIES; i++){
-    if(pgdir[i] & PTE_P){
+  for(i = 0; i < PDX(KERNBASE); i++){
+    if(pgdir[i] & PTE_PS)
+      kfreesuper(P2V(PTE_ADDR(pgdir[i])));
+    else if(pgdir[i] & PTE_P){
       char * v = P2V(PTE_ADDR(pgdir[i]));
       kfree(v);
     }
+    pgdir[i] = 0;  // pgdir may stay loaded on an idle CPU
   }
   kfree((char*)pgdir);
 }
@@ -323,12 +382,17 @@ copyuvm(pde_t *pgdir, uint sz)
   if((d = setupkvm()) == 0)
     return 0;
   for(i = 0; i < sz; i += PGSIZE){
-    if((pte = walkpgdir(pgdir, (void *) i, 0)) == 0)
-      panic("copyuvm: pte should exist");
-    if(!(*pte & PTE_P))
-      panic("copyuvm: page not present");
+    if((pte = walkpgdir(pgdir, (void *) i, 0)) == 0 || !(*pte & PTE_P))
+      continue;  // not faulted in yet; the child will do it itself
     pa = PTE_ADDR(*pte);
     flags = PTE_FLAGS(*pte);
+    if(flags & PTE_COW){
+      // Unmodified page of the page cache: share it.
+      if(mappages(d, (void*)i, PGSIZE, pa, flags) < 0)
+        goto bad;
+      kincref(P2V(pa));
+      continue;
+    }
     if((mem = kalloc()) == 0)
       goto bad;
     memmove(mem, (char*)P2V(pa), PGSIZE);
@@ -359,6 +423,33 @@ uva2ka(pde_t *pgdir, char *uva)
   return (char*)P2V(PTE_ADDR(*pte));
 }
 
+// Return the kernel address of user address va of process p,
+// for a device to transfer data directly from (or, if write
+// is set, to) the page, or 0 if the page isn't present or
+// isn't writable.  A copy-on-write page is made private first.
+char*
+uvaddr(struct proc *p, uint va, int write)
+{
+  pde_t *pde;
+  pte_t *pte;
+
+  if(va >= KERNBASE)
+    return 0;
+  pde = &p->pgdir[PDX(va)];
+  if((*pde & (PTE_P|PTE_PS|PTE_U)) == (PTE_P|PTE_PS|PTE_U)){
+    if(write && (*pde & PTE_W) == 0)
+      return 0;
+    return (char*)P2V(PTE_ADDR(*pde)) + va % SUPERPGSIZE;
+  }
+  pte = walkpgdir(p->pgdir, (char*)va, 0);
+  if(pte == 0 || (*pte & (PTE_P|PTE_U)) != (PTE_P|PTE_U))
+    return 0;
+  if(write && (*pte & PTE_W) == 0 &&
+     ((*pte & PTE_COW) == 0 || vmfault(p, va, FEC_WR) < 0))
+    return 0;
+  return (char*)P2V(PTE_ADDR(*pte)) + (va & (PGSIZE-1));
+}
+
 // Copy len bytes from p to user address va in page table pgdir.
 // Most useful when pgdir is not the current page table.
 // uva2ka ensures this only works for PTE_U pages.
@@ -386,7 +477,496 @@ copyout(pde_t *pgdir, uint va, void *p, uint len)
 }
 
 //PAGEBREAK!
-// Blank page.
+// Demand paging.
+//
+// exec() does not read the program into memory; it records
+// each segment as a struct vma and leaves its pages unmapped.
+// mmap() adds more regions above the heap, growing down from
+// KERNBASE.  The first access to a page of a region faults
+// into vmfault(), which maps a page from the page cache
+// (shared by every process using the same file) or a private
+// zero-filled page.  Private writable regions map cached pages
+// copy-on-write; shared ones map them writable and write the
+// dirty pages back to the file when they are unmapped.
+// MAP_HUGE regions are the exception: they are mapped with 4MB
+// pages from kallocsuper() up front, and never fault.
+
+// Return the region of p containing [va, va+n), or 0.
+struct vma*
+vmalookup(struct proc *p, uint va, uint n)
+{
+  struct vma *v;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++)
+    if((v->flags & VMA_USED) && va >= v->start && va < v->end &&
+       va + n >= va && va + n <= v->end)
+      return v;
+  return 0;
+}
+
+// Handle a page fault at va in process p, with x86 error code err.
+// Returns 0 if the access can be retried, -1 if it is a real fault.
+int
+vmfault(struct proc *p, uint va, uint err)
+{
+  struct vma *v;
+  pte_t *pte;
+  char *mem, *page;
+  uint a, off, n;
+  int perm;
+
+  if(va >= KERNBASE)
+    return -1;
+  a = PGROUNDDOWN(va);
+
+  if((pte = walkpgdir(p->pgdir, (char*)a, 0)) != 0 && (*pte & PTE_P)){
+    // Write to a shared copy-on-write page: make it private.
+    if((err & FEC_WR) == 0 || (*pte & PTE_COW) == 0)
+      return -1;
+    page = P2V(PTE_ADDR(*pte));
+    if(krefcnt(page) == 1){
+      *pte = (*pte | PTE_W) & ~PTE_COW;
+    } else {
+      if((mem = kalloc()) == 0)
+        return -1;
+      memmove(mem, page, PGSIZE);
+      *pte = V2P(mem) | ((PTE_FLAGS(*pte) | PTE_W) & ~PTE_COW);
+      kfree(page);
+    }
+    lcr3(V2P(p->pgdir));  // flush the stale read-only TLB entry
+    return 0;
+  }
+
+  if((v = vmalookup(p, a, 1)) == 0 || (v->flags & VMA_HUGE))
+    return -1;
+  if((err & FEC_WR) && (v->flags & VMA_WRITE) == 0)
+    return -1;
+
+  perm = PTE_U;
+  off = a - v->start;
+  if(v->shm){
+    // Page of a shared memory segment.
+    if((mem = shmpage(v->shm, off / PGSIZE)) == 0)
+      return -1;
+    perm |= PTE_W;
+  } else if(v->ip && off < v->filesz){
+    // A shared mapping must map the cached page itself, or
+    // it would not see the file change, nor others its writes.
+    ilock(v->ip);
+    if(v->flags & VMA_SHARED)
+      page = pcacheshared(v->ip, v->off + off);
+    else
+      page = pcacheget(v->ip, v->off + off);
+    iunlock(v->ip);
+    if(page == 0)
+      return -1;
+    if(v->flags & VMA_SHARED){
+      // Everyone mapping the file sees the cached page.
+      mem = page;
+      if(v->flags & VMA_WRITE)
+        perm |= PTE_W;
+    } else if(off + PGSIZE <= v->filesz && (err & FEC_WR) == 0){
+      // Share the cached page until somebody writes it.
+      mem = page;
+      if(v->flags & VMA_WRITE)
+        perm |= PTE_COW;
+    } else {
+      // Private copy of the file data, then zeroes.
+      if((mem = kalloc()) == 0){
+        kfree(page);
+        return -1;
+      }
+      n = v->filesz - off;
+      if(n > PGSIZE)
+        n = PGSIZE;
+      memmove(mem, page, n);
+      memset(mem + n, 0, PGSIZE - n);
+      kfree(page);
+      if(v->flags & VMA_WRITE)
+        perm |= PTE_W;
+    }
+  } else {
+    if((mem = kalloc()) == 0)
+      return -1;
+    memset(mem, 0, PGSIZE);
+    if(v->flags & VMA_WRITE)
+      perm |= PTE_W;
+  }
+  if(mappages(p->pgdir, (char*)a, PGSIZE, V2P(mem), perm) < 0){
+    kfree(mem);
+    return -1;
+  }
+  return 0;
+}
+
+// Fault in the user pages covering [va, va+n) of process p, so
+// that the kernel can then use them without a page fault that
+// might have to sleep, e.g. while it holds a spinlock.
+int
+vmtouch(struct proc *p, uint va, uint n)
+{
+  uint a, last;
+  pte_t *pte;
+
+  if(n == 0)
+    return 0;
+  a = PGROUNDDOWN(va);
+  last = PGROUNDDOWN(va + n - 1);
+  for(;;){
+    pte = walkpgdir(p->pgdir, (char*)a, 0);
+    if((p->pgdir[PDX(a)] & PTE_PS) == 0 &&
+       (pte == 0 || (*pte & PTE_P) == 0) && vmfault(p, a, 0) < 0)
+      return -1;
+    if(a == last)
+      break;
+    a += PGSIZE;
+  }
+  return 0;
+}
+
+// Copy the pages of region v from pgdir s into d, for fork().
+// Shared regions and untouched cached pages map the same
+// physical pages; private pages are copied.
+int
+vmacopy(pde_t *d, pde_t *s, struct vma *v)
+{
+  pte_t *pte;
+  uint a, pa, flags;
+  char *mem;
+
+  if(v->flags & VMA_HUGE){
+    for(a = v->start; a < v->end; a += SUPERPGSIZE){
+      pa = PTE_ADDR(s[PDX(a)]);
+      if(v->flags & VMA_SHARED){
+        ksuperincref(P2V(pa));
+        d[PDX(a)] = s[PDX(a)] & ~PTE_D;
+        continue;
+      }
+      if((mem = kallocsuper()) == 0)
+        return -1;
+      memmove(mem, (char*)P2V(pa), SUPERPGSIZE);
+      d[PDX(a)] = V2P(mem) | (PTE_FLAGS(s[PDX(a)]) & ~PTE_D);
+    }
+    return 0;
+  }
+
+  for(a = v->start; a < v->end; a += PGSIZE){
+    if((pte = walkpgdir(s, (void*)a, 0)) == 0 || !(*pte & PTE_P))
+      continue;
+    pa = PTE_ADDR(*pte);
+    flags = PTE_FLAGS(*pte) & ~PTE_D;
+    if((v->flags & VMA_SHARED) || (flags & PTE_COW)){
+      if(mappages(d, (void*)a, PGSIZE, pa, flags) < 0)
+        return -1;
+      kincref(P2V(pa));
+      continue;
+    }
+    if((mem = kalloc()) == 0)
+      return -1;
+    memmove(mem, (char*)P2V(pa), PGSIZE);
+    if(mappages(d, (void*)a, PGSIZE, V2P(mem), flags) < 0){
+      kfree(mem);
+      return -1;
+    }
+  }
+  return 0;
+}
+
+// Write the modified pages of [start, end) of a shared file
+// region back to the file.  Never extends the file.
+static void
+vmasync(pde_t *pgdir, struct vma *v, uint start, uint end)
+{
+  pte_t *pte;
+  char *page;
+  uint a, off, i, n;
+  // Write a few blocks at a time, as filewrite() does.
+  int max = logwritemax();
+
+  if(v->ip == 0 ||
+     (v->flags & (VMA_SHARED|VMA_WRITE)) != (VMA_SHARED|VMA_WRITE))
+    return;
+  for(a = start; a < end; a += PGSIZE){
+    if((pte = walkpgdir(pgdir, (void*)a, 0)) == 0 ||
+       (*pte & (PTE_P|PTE_D)) != (PTE_P|PTE_D))
+      continue;
+    page = P2V(PTE_ADDR(*pte));
+    off = v->off + (a - v->start);
+    for(i = 0; i < PGSIZE; i += n){
+      begin_write(PGSIZE - i < max ? PGSIZE - i : max);
+      ilock(v->ip);
+      if(v->ip->size != v->ip->dsize){
+        // Delayed writes must reach the disk first.
+        iunlock(v->ip);
+        end_op();
+        iflush(v->ip);
+        n = 0;
+        continue;
+      }
+      if(off + i >= v->ip->size){
+        iunlock(v->ip);
+        end_op();
+        break;
+      }
+      n = v->ip->size - (off + i);
+      if(n > max)
+        n = max;
+      if(n > PGSIZE - i)
+        n = PGSIZE - i;
+      writei(v->ip, page + i, off + i, n);
+      iunlock(v->ip);
+      end_op();
+    }
+    *pte &= ~PTE_D;
+  }
+}
+
+// Tear down the regions in vma[0..NVMA-1], writing shared
+// file pages in pgdir (if not 0) back to their files first.
+// The pages themselves are freed along with pgdir.
+void
+freevma(pde_t *pgdir, struct vma *vma)
+{
+  int i;
+
+  for(i = 0; i < NVMA; i++)
+    if(pgdir && (vma[i].flags & VMA_USED))
+      vmasync(pgdir, &vma[i], vma[i].start, vma[i].end);
+
+  begin_op();
+  for(i = 0; i < NVMA; i++){
+    if(vma[i].ip)
+      iput(vma[i].ip);
+    if(vma[i].shm)
+      shmput(vma[i].shm);
+    memset(&vma[i], 0, sizeof(vma[i]));
+  }
+  end_op();
+}
+
+// Free the 4MB pages mapped at [start, end) in pgdir.
+static void
+unmaphuge(pde_t *pgdir, uint start, uint end)
+{
+  uint a;
+
+  for(a = start; a < end; a += SUPERPGSIZE){
+    if(pgdir[PDX(a)] & PTE_PS)
+      kfreesuper(P2V(PTE_ADDR(pgdir[PDX(a)])));
+    pgdir[PDX(a)] = 0;
+  }
+}
+
+// Reserve a free region of len bytes (a multiple of align, which
+// is PGSIZE or SUPERPGSIZE) in process p, at addr if that range
+// is free, else at the highest free range below KERNBASE that
+// stays clear of the heap.
+// Returns the new region with only start, end and VMA_USED set.
+struct vma*
+vmareserve(struct proc *p, uint addr, uint len, uint align)
+{
+  struct vma *v, *nv;
+  int i;
+
+  nv = 0;
+  for(v = p->vma; v < &p->vma[NVMA]; v++)
+    if((v->flags & VMA_USED) == 0){
+      nv = v;
+      break;
+    }
+  if(nv == 0 || len == 0 || len > KERNBASE)
+    return 0;
+
+  if(addr == 0 || addr % align != 0 || addr < PGROUNDUP(p->sz) ||
+     addr + len > KERNBASE || addr + len < addr)
+    addr = KERNBASE - len;
+  for(i = 0; i < NVMA; i++){
+    v = &p->vma[i];
+    if((v->flags & VMA_USED) && addr < v->end && addr + len > v->start){
+      if(v->start < len)
+        return 0;
+      addr = (v->start - len) & ~(align-1);
+      i = -1;  // rescan
+    }
+  }
+  if(addr < PGROUNDUP(p->sz))
+    return 0;
+  // A 4MB page must not share its page directory entry with
+  // the heap's page table.
+  if(align == SUPERPGSIZE && addr < SUPERPGROUNDUP(p->sz))
+    return 0;
+
+  memset(nv, 0, sizeof(*nv));
+  nv->start = addr;
+  nv->end = addr + len;
+  nv->flags = VMA_USED;
+  return nv;
+}
+
+// Map len bytes (a multiple of 4MB) of zeroes into the current
+// process using 4MB pages, for large regions that would otherwise
+// need many TLB entries.  The pages come from a small reserved
+// pool, see kallocsuper().
+static int
+mmaphuge(uint addr, uint len, int prot, int flags)
+{
+  struct proc *curproc = myproc();
+  struct vma *nv;
+  uint a, perm;
+  char *mem, *oldpt[NSUPERPAGE];
+  int i, n;
+
+  if(len == 0 || (nv = vmareserve(curproc, addr, len, SUPERPGSIZE)) == 0)
+    return -1;
+  nv->flags |= VMA_MMAP | VMA_HUGE;
+  perm = PTE_P | PTE_U | PTE_PS;
+  if(prot & PROT_WRITE){
+    nv->flags |= VMA_WRITE;
+    perm |= PTE_W;
+  }
+  if(flags & MAP_SHARED)
+    nv->flags |= VMA_SHARED;
+
+  // Each 4MB page replaces the empty page table left by earlier
+  // mappings there, if any.  The TLB may still cache the old
+  // translations, so the page tables are freed only after the
+  // flush.  There are at most NSUPERPAGE of them.
+  n = 0;
+  for(a = nv->start; a < nv->end; a += SUPERPGSIZE){
+    if((mem = kallocsuper()) == 0)
+      break;
+    memset(mem, 0, SUPERPGSIZE);
+    if(curproc->pgdir[PDX(a)] & PTE_P)
+      oldpt[n++] = P2V(PTE_ADDR(curproc->pgdir[PDX(a)]));
+    curproc->pgdir[PDX(a)] = V2P(mem) | perm;
+  }
+  if(a < nv->end)
+    unmaphuge(curproc->pgdir, nv->start, a);
+  lcr3(V2P(curproc->pgdir));
+  for(i = 0; i < n; i++)
+    kfree(oldpt[i]);
+  if(a < nv->end){
+    memset(nv, 0, sizeof(*nv));
+    return -1;
+  }
+  return nv->start;
+}
+
+// Map len bytes of f at offset off (or zeroes if f is 0) into
+// the current process, near addr if possible.
+// Returns the address of the mapping, or -1.
+int
+mmap(uint addr, uint len, int prot, int flags, struct file *f, uint off)
+{
+  struct proc *curproc = myproc();
+  struct vma *nv;
+
+  if(len == 0 || off % PGSIZE != 0 || len > KERNBASE)
+    return -1;
+  if(((flags & MAP_SHARED) != 0) == ((flags & MAP_PRIVATE) != 0))
+    return -1;
+  if(f){
+    // Only regular files: faults on a device would read it
+    // from the page fault handler.
+    if(f->type != FD_INODE || f->ip->type != T_FILE || !f->readable)
+      return -1;
+    if((flags & MAP_SHARED) && (prot & PROT_WRITE) && !f->writable)
+      return -1;
+  }
+  if(flags & MAP_HUGE){
+    if(f)
+      return -1;
+    return mmaphuge(addr, SUPERPGROUNDUP(len), prot, flags);
+  }
+  len = PGROUNDUP(len);
+  if((nv = vmareserve(curproc, addr, len, PGSIZE)) == 0)
+    return -1;
+  nv->flags |= VMA_MMAP;
+  if(prot & PROT_WRITE)
+    nv->flags |= VMA_WRITE;
+  if(flags & MAP_SHARED)
+    nv->flags |= VMA_SHARED;
+  nv->ip = f ? idup(f->ip) : 0;
+  nv->off = off;
+  nv->filesz = f ? len : 0;
+
+  // Anonymous shared memory must exist before a fork()
+  // for parent and child to see the same pages.
+  if(f == 0 && (flags & MAP_SHARED) &&
+     allocuvm(curproc->pgdir, nv->start, nv->end) == 0){
+    memset(nv, 0, sizeof(*nv));
+    return -1;
+  }
+  return nv->start;
+}
+
+// Remove the mappings of [addr, addr+len) in the current
+// process, which must lie within a single mmap() region.
+int
+munmap(uint addr, uint len)
+{
+  struct proc *curproc = myproc();
+  struct vma *v, *nv;
+  uint end, cut;
+
+  if(addr % PGSIZE != 0 || len == 0)
+    return -1;
+  end = PGROUNDUP(addr + len);
+  if(end < addr || (v = vmalookup(curproc, addr, end - addr)) == 0 ||
+     (v->flags & VMA_MMAP) == 0)
+    return -1;
+
+  // 4MB regions can only be unmapped as a whole.
+  if(v->flags & VMA_HUGE){
+    if(addr != v->start || end != v->end)
+      return -1;
+    unmaphuge(curproc->pgdir, v->start, v->end);
+    lcr3(V2P(curproc->pgdir));
+    memset(v, 0, sizeof(*v));
+    return 0;
+  }
+
+  // Unmapping the middle of a region splits it in two.
+  nv = 0;
+  if(addr > v->start && end < v->end){
+    for(nv = curproc->vma; nv < &curproc->vma[NVMA]; nv++)
+      if((nv->flags & VMA_USED) == 0)
+        break;
+    if(nv == &curproc->vma[NVMA])
+      return -1;
+  }
+
+  vmasync(curproc->pgdir, v, addr, end);
+  deallocuvm(curproc->pgdir, end, addr);
+  lcr3(V2P(curproc->pgdir));
+
+  if(nv){
+    *nv = *v;
+    cut = end - v->start;
+    nv->start = end;
+    nv->off += cut;
+    nv->filesz = nv->filesz > cut ? nv->filesz - cut : 0;
+    if(nv->ip)
+      idup(nv->ip);
+    v->end = addr;
+  } else if(addr == v->start && end == v->end){
+    if(v->ip){
+      begin_op();
+      iput(v->ip);
+      end_op();
+    }
+    memset(v, 0, sizeof(*v));
+  } else if(addr == v->start){
+    cut = end - v->start;
+    v->start = end;
+    v->off += cut;
+    v->filesz = v->filesz > cut ? v->filesz - cut : 0;
+  } else {
+    v->end = addr;
+  }
+  return 0;
+}
+
 //PAGEBREAK!
 // Blank page.
 //PAGEBREAK!
@@ -0,0 +1,95 @@
+// Test delayed writes: files opened with O_WBACK.
+
+#include "types.h"
+#include "stat.h"
+#include "fcntl.h"
+#include "user.h"
+
+#define FILESZ (40*512 + 100)
+
+char buf[FILESZ], rbuf[FILESZ];
+
+void
+fail(char *msg)
+{
+  printf(1, "wbacktest: %s failed\n", msg);
+  exit();
+}
+
+void
+check(char *name, int n)
+{
+  int fd, i;
+
+  if((fd = open(name, O_RDONLY)) < 0)
+    fail("open for read");
+  memset(rbuf, 0, sizeof(rbuf));
+  if(read(fd, rbuf, sizeof(rbuf)) != n)
+    fail("read size");
+  for(i = 0; i < n; i++)
+    if(rbuf[i] != buf[i])
+      fail("read contents");
+  close(fd);
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct stat st;
+  int fd, i;
+
+  for(i = 0; i < FILESZ; i++)
+    buf[i] = 'a' + i % 26;
+
+  // Delayed writes are visible before they reach the disk.
+  unlink("wback.tmp");
+  if((fd = open("wback.tmp", O_CREATE|O_RDWR|O_WBACK)) < 0)
+    fail("create");
+  for(i = 0; i < FILESZ; i += 100)
+    if(write(fd, buf + i, FILESZ - i < 100 ? FILESZ - i : 100) < 0)
+      fail("write");
+  if(fstat(fd, &st) < 0 || st.size != FILESZ)
+    fail("size before fsync");
+  check("wback.tmp", FILESZ);
+
+  // Overwrite part of the file, then make it durable.
+  buf[10] = buf[5000] = 'Z';
+  close(fd);
+  if((fd = open("wback.tmp", O_RDWR|O_WBACK)) < 0)
+    fail("reopen");
+  if(write(fd, buf, 5001) != 5001)
+    fail("overwrite");
+  if(fsync(fd) < 0)
+    fail("fsync");
+  close(fd);
+  check("wback.tmp", FILESZ);
+
+  // A write-through write after delayed ones.
+  if((fd = open("wback.tmp", O_RDWR|O_WBACK)) < 0)
+    fail("reopen");
+  if(write(fd, "y", 1) != 1)
+    fail("delayed write");
+  close(fd);
+  buf[0] = 'y';
+  buf[1] = 'x';
+  if((fd = open("wback.tmp", O_RDWR)) < 0)
+    fail("reopen");
+  if(read(fd, rbuf, 1) != 1 || write(fd, "x", 1) != 1)
+    fail("write through");
+  close(fd);
+  check("wback.tmp", FILESZ);
+
+  // Unlinking a file with delayed writes.
+  if((fd = open("wback.tmp", O_RDWR|O_WBACK)) < 0)
+    fail("reopen");
+  if(write(fd, buf, 1000) != 1000)
+    fail("write before unlink");
+  close(fd);
+  if(unlink("wback.tmp") < 0)
+    fail("unlink");
+  if(open("wback.tmp", O_RDONLY) >= 0)
+    fail("unlinked file still there");
+
+  printf(1, "wbacktest ok\n");
+  exit();
+}
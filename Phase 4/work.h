@@ -0,0 +1,10 @@
+// A call to fn(arg) to be made later by a kworker thread.
+struct work {
+  void (*fn)(void*);
+  void *arg;
+  uint pending;      // on a work queue
+  uint timed;        // waiting on the timer list for tick when
+  uint when;
+  struct work *next; // work queue
+  struct work *tnext; // timer list
+};
@@ -0,0 +1,163 @@
+// Deferred work.
+//
+// A work item is a function call that a kernel thread makes
+// later, off the path of whoever asked for it.  Each CPU has a
+// queue of work and a kworker thread that runs only on that
+// CPU and makes the calls in the order they were queued.
+//
+// Interface:
+// * initwork() sets up a work item.
+// * queuework() puts it on the queue of the calling CPU, so
+//   that it runs where its data is likely to be cached.  It
+//   may be called from an interrupt handler.
+// * workafter() queues it once n ticks have passed.
+//
+// An item is on at most one queue at a time: queueing an item
+// that is still pending does nothing, and the item is no
+// longer pending by the time its function is called, so the
+// function may queue it again.  Work functions may sleep,
+// which holds up the rest of their CPU's queue.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "x86.h"
+#include "proc.h"
+#include "spinlock.h"
+#include "work.h"
+
+struct workq {
+  struct spinlock lock;
+  struct work *head;
+  struct work *tail;
+};
+
+struct workq workq[NCPU];
+
+struct {
+  struct spinlock lock;
+  struct work *list;  // items waiting for their tick
+} timers;
+
+void
+initwork(struct work *w, void (*fn)(void*), void *arg)
+{
+  memset(w, 0, sizeof(*w));
+  w->fn = fn;
+  w->arg = arg;
+}
+
+// Put w at the end of q.
+static void
+enqueue(struct workq *q, struct work *w)
+{
+  acquire(&q->lock);
+  w->next = 0;
+  if(q->tail)
+    q->tail->next = w;
+  else
+    q->head = w;
+  q->tail = w;
+  wakeup(q);
+  release(&q->lock);
+}
+
+// Queue w on this CPU's work queue.
+// Returns 0 if w was already pending.
+int
+queuework(struct work *w)
+{
+  struct workq *q;
+
+  if(xchg(&w->pending, 1) != 0)
+    return 0;
+  pushcli();
+  q = &workq[cpuid()];
+  popcli();
+  enqueue(q, w);
+  return 1;
+}
+
+// Queue w once n ticks have passed.
+// Returns 0 if w was already waiting for its tick.
+int
+workafter(struct work *w, int n)
+{
+  acquire(&timers.lock);
+  if(w->timed){
+    release(&timers.lock);
+    return 0;
+  }
+  w->timed = 1;
+  w->when = ticks + n;
+  w->tnext = timers.list;
+  timers.list = w;
+  release(&timers.lock);
+  return 1;
+}
+
+// Called by the timer interrupt handler on every tick:
+// queue the items whose tick has come.
+void
+worktick(void)
+{
+  struct work **pp, *w;
+
+  acquire(&timers.lock);
+  for(pp = &timers.list; (w = *pp) != 0; ){
+    if((int)(ticks - w->when) < 0){
+      pp = &w->tnext;
+      continue;
+    }
+    *pp = w->tnext;
+    w->timed = 0;
+    queuework(w);
+  }
+  release(&timers.lock);
+}
+
+// Body of the kworker thread of the CPU whose queue is q.
+static void
+kworker(void *arg)
+{
+  struct workq *q = arg;
+  struct work *w;
+
+  // Move to our CPU.
+  myproc()->bound = &cpus[q - workq];
+  yield();
+
+  acquire(&q->lock);
+  for(;;){
+    if((w = q->head) == 0){
+      sleep(q, &q->lock);
+      continue;
+    }
+    q->head = w->next;
+    if(q->head == 0)
+      q->tail = 0;
+    release(&q->lock);
+    xchg(&w->pending, 0);
+    w->fn(w->arg);
+    acquire(&q->lock);
+  }
+}
+
+// Start a kworker thread for each CPU.
+void
+workinit(void)
+{
+  char name[16];
+  int i;
+
+  initlock(&timers.lock, "timers");
+  for(i = 0; i < NCPU; i++)
+    initlock(&workq[i].lock, "workq");
+  for(i = 0; i < ncpu; i++){
+    safestrcpy(name, "kworker0", sizeof(name));
+    name[7] += i;
+    kthread_create(kworker, &workq[i], name);
+  }
+}
@@ -0,0 +1,60 @@
+// File write benchmark: write a file with large write()
+// calls over and over, as cp or a compiler writing its
+// output would.  Each write() is split into as few log
+// transactions as the log size allows.  With -w the file is
+// opened with O_WBACK instead, so its writes are delayed in
+// the page cache, for comparison.
+//
+// usage: writebench [-w] [kbytes]
+
+#include "types.h"
+#include "stat.h"
+#include "fcntl.h"
+#include "user.h"
+
+#define ROUNDS 16
+#define MAXKB 64  // stays within the largest file size
+
+char buf[MAXKB*1024];
+
+int
+main(int argc, char *argv[])
+{
+  int r, fd, n, start, ticks, mode;
+
+  mode = O_CREATE|O_WRONLY;
+  if(argc > 1 && strcmp(argv[1], "-w") == 0){
+    mode |= O_WBACK;
+    argc--;
+    argv++;
+  }
+  n = MAXKB;
+  if(argc > 1)
+    n = atoi(argv[1]);
+  if(n < 1 || n > MAXKB){
+    printf(2, "usage: writebench [-w] [kbytes], at most %d\n", MAXKB);
+    exit();
+  }
+  n *= 1024;
+  memset(buf, 'w', n);
+
+  start = uptime();
+  for(r = 0; r < ROUNDS; r++){
+    unlink("writebench.tmp");
+    if((fd = open("writebench.tmp", mode)) < 0){
+      printf(1, "writebench: cannot create file\n");
+      exit();
+    }
+    if(write(fd, buf, n) != n){
+      printf(1, "writebench: write failed\n");
+      exit();
+    }
+    close(fd);
+  }
+  ticks = uptime() - start;
+  unlink("writebench.tmp");
+
+  printf(1, "%d rounds x %d KB%s: %d ticks\n", ROUNDS, n/1024,
+         (mode & O_WBACK) ? " delayed" : "", ticks);
+  exit();
+}